@@ -0,0 +1,113 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// checks that otp_crc_forge_0xf0b8() picks exactly the same two bytes as
+// the bitwise CRC and brute force search it replaced, over random token
+// plaintexts, and times both.
+//
+// src/otp.c is included rather than linked, to get at its static functions.
+
+#include "../../src/otp.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#define INPUTS 2000000
+
+// otp_crc() and otp_crc_forge_0xf0b8() as they were before the nibble table
+static uint16_t old_otp_crc(uint8_t *data, uint32_t length, uint16_t crc) {
+    uint32_t i;
+    for (i = 0; i < length; i++) {
+        crc ^= data[i];
+        uint8_t j;
+        for (j = 0; j < 8; j++) {
+            uint16_t n = crc & 1;
+            crc >>= 1;
+            if (n) {
+                crc ^= 0x8408;
+            }
+        }
+    }
+    return crc;
+}
+
+static void old_otp_crc_forge_0xf0b8(uint8_t *data, uint32_t length) {
+    uint16_t partial_crc = old_otp_crc(data, length, 0xffff);
+    data[length] = 0;
+    do {
+        uint16_t crc = old_otp_crc(&data[length], 1, partial_crc);
+        if (crc >> 8 == 0x0f) {
+            data[length + 1] = 0x87 ^ (crc & 0xff);
+            return;
+        }
+    } while (++data[length] != 0);
+
+    THROW(EXCEPTION);
+}
+
+// fixed, so that every run checks the same inputs
+static uint32_t random_state = 0x79756269;
+
+static uint8_t random_byte(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static double seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(void) {
+    static uint8_t inputs[INPUTS][OTP_TOKEN_PLAINTEXT_LEN];
+    static uint8_t expected[INPUTS][OTP_TOKEN_PLAINTEXT_LEN];
+    uint32_t i, j;
+    for (i = 0; i < INPUTS; i++) {
+        for (j = 0; j < OTP_TOKEN_PLAINTEXT_LEN - 2; j++) {
+            inputs[i][j] = random_byte();
+        }
+    }
+    os_memmove(expected, inputs, sizeof(inputs));
+
+    double start = seconds();
+    for (i = 0; i < INPUTS; i++) {
+        old_otp_crc_forge_0xf0b8(expected[i], OTP_TOKEN_PLAINTEXT_LEN - 2);
+    }
+    double old_time = seconds() - start;
+
+    start = seconds();
+    for (i = 0; i < INPUTS; i++) {
+        otp_crc_forge_0xf0b8(inputs[i], OTP_TOKEN_PLAINTEXT_LEN - 2);
+    }
+    double new_time = seconds() - start;
+
+    uint32_t mismatches = 0;
+    for (i = 0; i < INPUTS; i++) {
+        if (os_memcmp(inputs[i], expected[i], OTP_TOKEN_PLAINTEXT_LEN) != 0 ||
+            otp_crc(inputs[i], OTP_TOKEN_PLAINTEXT_LEN, 0xffff) != 0xf0b8) {
+            mismatches++;
+        }
+    }
+
+    printf("%d plaintexts, %u forged differently\n", INPUTS, mismatches);
+    printf("  brute force  %8.1f ns per plaintext\n", old_time / INPUTS * 1e9);
+    printf("  closed form  %8.1f ns per plaintext\n", new_time / INPUTS * 1e9);
+    return mismatches != 0;
+}
@@ -0,0 +1,172 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// compares looking keyslots up by public ID with a linear scan of the
+// keyslot table against the binary search over public_id_index that
+// src/main.c does, at a few table sizes.
+//
+// the lookups are copies of the ones in main.c, since that can't be built
+// for the host. the number of public ID comparisons per lookup is what
+// matters on the device, where each one reads flash; the host timings are
+// only there to show the trend.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "otp.h"
+
+namespace {
+
+// the index holds uint8_t on the device, which is enough for its 255
+// keyslots at most. wider here so that 1000 keyslots can be tried.
+struct Table {
+    std::vector<otpKeySlot_t> keyslots;
+    std::vector<bool> occupied;
+    std::vector<uint16_t> public_id_index;
+};
+
+uint64_t comparisons;
+
+int compare_public_id(const uint8_t *a, const uint8_t *b) {
+    comparisons++;
+    return memcmp(a, b, OTP_PUBLIC_ID_LEN);
+}
+
+// find_keyslot_by_public_id() before the index
+uint32_t find_linear(const Table &table, const uint8_t *public_id) {
+    for (uint32_t i = 0; i < table.keyslots.size(); i++) {
+        if (table.occupied[i] &&
+            compare_public_id(table.keyslots[i].public_id, public_id) == 0) {
+            return i;
+        }
+    }
+    return -1U;
+}
+
+// public_id_index_lower_bound()
+uint32_t lower_bound(const Table &table, const uint8_t *public_id,
+                     uint32_t count) {
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        if (compare_public_id(
+                table.keyslots[table.public_id_index[middle]].public_id,
+                public_id) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// find_keyslot_by_public_id() with the index
+uint32_t find_indexed(const Table &table, const uint8_t *public_id) {
+    uint32_t count = table.public_id_index.size();
+    uint32_t position = lower_bound(table, public_id, count);
+    if (position < count &&
+        compare_public_id(
+            table.keyslots[table.public_id_index[position]].public_id,
+            public_id) == 0) {
+        return table.public_id_index[position];
+    }
+    return -1U;
+}
+
+// rebuild_public_id_index()
+void rebuild_index(Table &table) {
+    table.public_id_index.clear();
+    for (uint32_t i = 0; i < table.keyslots.size(); i++) {
+        if (!table.occupied[i]) {
+            continue;
+        }
+        uint32_t position = lower_bound(table, table.keyslots[i].public_id,
+                                        table.public_id_index.size());
+        table.public_id_index.insert(table.public_id_index.begin() + position,
+                                     i);
+    }
+}
+
+// every keyslot in use, as after a long series of adds
+Table make_table(uint32_t size, std::mt19937 &random) {
+    Table table;
+    table.keyslots.resize(size);
+    table.occupied.assign(size, true);
+    for (otpKeySlot_t &key : table.keyslots) {
+        for (uint8_t &byte : key.public_id) {
+            byte = random();
+        }
+        key.boot_count = 1;
+    }
+    return table;
+}
+
+template <typename Find>
+void measure(const char *name, const Table &table,
+             const std::vector<std::vector<uint8_t>> &queries, Find find) {
+    const uint32_t rounds = 200;
+    uint32_t found = 0;
+    comparisons = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t round = 0; round < rounds; round++) {
+        for (const std::vector<uint8_t> &query : queries) {
+            found += find(table, query.data()) != -1U;
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    double lookups = double(rounds) * queries.size();
+    printf("  %-8s %8.1f comparisons %8.1f ns  per lookup (%u found)\n", name,
+           comparisons / lookups,
+           std::chrono::duration<double, std::nano>(elapsed).count() / lookups,
+           found / rounds);
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 random(42);
+    for (uint32_t size : {10, 100, 1000}) {
+        Table table = make_table(size, random);
+        comparisons = 0;
+        rebuild_index(table);
+        printf("%u keyslots, %llu comparisons to build the index\n", size,
+               (unsigned long long)comparisons);
+
+        // every public ID in use, and as many that aren't
+        std::vector<std::vector<uint8_t>> queries;
+        for (const otpKeySlot_t &key : table.keyslots) {
+            queries.emplace_back(key.public_id,
+                                 key.public_id + OTP_PUBLIC_ID_LEN);
+            std::vector<uint8_t> missing(OTP_PUBLIC_ID_LEN);
+            for (uint8_t &byte : missing) {
+                byte = random();
+            }
+            queries.push_back(missing);
+        }
+        std::shuffle(queries.begin(), queries.end(), random);
+
+        measure("linear", table, queries, find_linear);
+        measure("indexed", table, queries, find_indexed);
+    }
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef HOST_APDU_H
+#define HOST_APDU_H
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// the app's APDU interface, as described in the README
+
+#define CLA 0xE0
+#define CLA_CHAINING 0x10
+
+#define INS_GET_OTP 0x01
+#define INS_GET_OTP_BATCH 0x02
+#define INS_IMPORT_KEYSLOTS 0x03
+#define INS_EXPORT_KEYSLOTS 0x04
+#define INS_GET_KEYSLOT_ORDER 0x05
+#define INS_MOVE_KEYSLOT 0x06
+#define INS_SET_FAVOURITE 0x07
+#define INS_GET_RESPONSE 0xC0
+
+#define P1_KEYSLOT_INDEX 0x00
+#define P1_KEYSLOT_PUBLIC_ID 0x01
+
+#define SW_OK 0x9000
+#define SW_BYTES_REMAINING 0x6100
+#define SW_WRONG_LENGTH 0x6700
+#define SW_LAST_COMMAND_EXPECTED 0x6883
+#define SW_DENIED 0x6985
+#define SW_TOKENS_EXHAUSTED 0x6986
+#define SW_WRONG_DATA 0x6A80
+#define SW_KEYSLOT_NOT_FOUND 0x6A83
+#define SW_NOT_ENOUGH_KEYSLOTS 0x6A84
+#define SW_WRONG_P1P2 0x6A86
+#define SW_NO_RESPONSE_DATA 0x6A88
+#define SW_INS_NOT_SUPPORTED 0x6D00
+#define SW_CLA_NOT_SUPPORTED 0x6E00
+
+// size of G_io_apdu_buffer on the device
+#define APDU_BUFFER_SIZE 260
+#define APDU_MAX_DATA 255
+
+// an APDU that the device answered with something other than SW_OK
+class ApduError : public std::runtime_error {
+  public:
+    explicit ApduError(uint16_t sw);
+    uint16_t sw() const { return sw_; }
+
+  private:
+    uint16_t sw_;
+};
+
+// something that APDUs can be exchanged with: a device, or a simulation of
+// one. exchange() takes a whole command APDU and returns the whole response,
+// status word included.
+class Transport {
+  public:
+    virtual ~Transport() {}
+    virtual std::vector<uint8_t> exchange(const std::vector<uint8_t> &apdu) = 0;
+    virtual std::string name() const = 0;
+};
+
+// sends a command, splitting data longer than one APDU into a chain, and
+// fetches the rest of a long response with GET_RESPONSE. every APDU of the
+// chain carries a multiple of record_length bytes, so that no record is
+// split between two of them.
+// returns the data of every part of the response, in order.
+std::vector<std::vector<uint8_t>> transmit(Transport &transport, uint8_t ins,
+                                           uint8_t p1, uint8_t p2,
+                                           const std::vector<uint8_t> &data,
+                                           size_t record_length = 1);
+
+std::string sw_description(uint16_t sw);
+
+#endif
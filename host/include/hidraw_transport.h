@@ -0,0 +1,53 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef HOST_HIDRAW_TRANSPORT_H
+#define HOST_HIDRAW_TRANSPORT_H
+
+#include <string>
+#include <vector>
+
+#include "apdu.h"
+
+// APDUs over the vendor-defined HID interface (HID_ReportDesc in
+// src/usbd_hid_impl.c), through a Linux hidraw node.
+// APDUs are framed the way the SDK's io_usb_hid layer expects: 64-byte
+// reports starting with the channel, a tag and a sequence number, the first
+// one also carrying the length of the whole APDU.
+class HidrawTransport : public Transport {
+  public:
+    HidrawTransport(const std::string &path, int timeout_ms);
+    ~HidrawTransport();
+    HidrawTransport(const HidrawTransport &) = delete;
+    HidrawTransport &operator=(const HidrawTransport &) = delete;
+
+    std::vector<uint8_t> exchange(const std::vector<uint8_t> &apdu) override;
+    std::string name() const override { return path_; }
+
+    // hidraw nodes of every connected Ledger's vendor-defined interface
+    static std::vector<std::string> enumerate();
+
+  private:
+    void send(const std::vector<uint8_t> &apdu);
+    std::vector<uint8_t> receive();
+
+    std::string path_;
+    int fd_;
+    int timeout_ms_;
+};
+
+#endif
@@ -0,0 +1,96 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef HOST_OTP_CLIENT_H
+#define HOST_OTP_CLIENT_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "apdu.h"
+
+// the token and key sizes come from the app itself
+extern "C" {
+#include "otp.h"
+}
+
+// public ID, then big-endian boot count
+#define IMPORT_RECORD_LEN (OTP_PUBLIC_ID_LEN + 2)
+// keyslot index, public ID, then big-endian boot count
+#define EXPORT_RECORD_LEN (1 + OTP_PUBLIC_ID_LEN + 2)
+#define EXPORT_END 0xFF
+#define KEYSLOT_NONE 0xFF
+
+typedef std::array<uint8_t, OTP_PUBLIC_ID_LEN> PublicId;
+typedef std::array<uint8_t, OTP_PRIVATE_ID_LEN> PrivateId;
+
+struct KeyslotRecord {
+    uint8_t index;
+    PublicId public_id;
+    uint16_t boot_count;
+};
+
+struct Inventory {
+    uint8_t tokens_used; // this session, out of 255
+    std::vector<KeyslotRecord> keyslots;
+};
+
+struct KeyslotOrder {
+    uint8_t favourite; // KEYSLOT_NONE if there is none
+    std::vector<uint8_t> keyslots; // in the order the menus list them
+};
+
+struct ImportRecord {
+    PublicId public_id;
+    uint16_t boot_count;
+};
+
+// the app's commands, on top of whatever transport reaches the device.
+// failures are thrown as ApduError.
+class OtpClient {
+  public:
+    explicit OtpClient(Transport &transport) : transport_(transport) {}
+
+    // a modhex token
+    std::string get_otp(uint8_t keyslot);
+    // binary tokens: public ID, then the encrypted block
+    std::vector<std::vector<uint8_t>> get_otp_batch(uint8_t keyslot,
+                                                    uint8_t count);
+    Inventory export_keyslots();
+    // returns the private IDs of the new keyslots, in the same order.
+    // the records are sent as one command, which is confirmed once on the
+    // device however many APDUs it takes.
+    std::vector<PrivateId> import_keyslots(
+        const std::vector<ImportRecord> &records);
+    KeyslotOrder get_keyslot_order();
+    // position 0 is the top of the menus
+    void move_keyslot(uint8_t keyslot, uint8_t position);
+    // KEYSLOT_NONE leaves no favourite
+    void set_favourite(uint8_t keyslot);
+
+  private:
+    Transport &transport_;
+};
+
+std::string to_modhex(const uint8_t *bytes, size_t length);
+std::string to_hex(const uint8_t *bytes, size_t length);
+// returns false if text isn't exactly length bytes of modhex
+bool from_modhex(const std::string &text, uint8_t *bytes, size_t length);
+
+#endif
@@ -0,0 +1,37 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef HOST_SIM_SDK_H
+#define HOST_SIM_SDK_H
+
+#include <cstdint>
+#include <mutex>
+
+// what sim_throw() throws: the same values the app's THROW() would
+struct SimThrow {
+    unsigned short exception;
+};
+
+// src/otp.c keeps its state in globals, so simulated devices take turns
+// using it: hold this while calling into it, with the device's seed set and
+// its session counter swapped in.
+extern std::mutex sim_otp_mutex;
+void sim_set_seed(const uint8_t *seed);
+
+extern "C" uint8_t token_count_since_boot;
+
+#endif
@@ -0,0 +1,99 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef HOST_SIMULATED_DEVICE_H
+#define HOST_SIMULATED_DEVICE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "apdu.h"
+
+extern "C" {
+#include "otp.h"
+}
+
+// an in-process stand-in for a device running the app, answering APDUs the
+// way src/main.c does, with tokens generated by the app's own src/otp.c.
+// every request is approved right away, as if the user had pressed Approve.
+// secrets are derived from a random per-device seed instead of BIP32, so
+// tokens won't match those of a real device.
+class SimulatedDevice : public Transport {
+  public:
+    // starts with initial_keys random keyslots, as if they had been added
+    // in an earlier session
+    SimulatedDevice(const std::string &name, uint32_t initial_keys);
+
+    std::vector<uint8_t> exchange(const std::vector<uint8_t> &apdu) override;
+    std::string name() const override { return name_; }
+
+    // starts a new session, as if the device had been unplugged: the token
+    // counter starts over, and every keyslot's boot count goes up again
+    // before its next token
+    void restart();
+
+  private:
+    // what the rest of a long response is made of, as in src/main.c
+    enum Continuation {
+        RESPONSE_NONE,
+        RESPONSE_EXPORT,
+        RESPONSE_OTP_BATCH,
+        RESPONSE_IMPORT
+    };
+
+    std::vector<uint8_t> handle(uint8_t ins, uint8_t p1, uint8_t p2,
+                                const std::vector<uint8_t> &data);
+    uint32_t select_keyslot(uint8_t p1, uint8_t p2,
+                            const std::vector<uint8_t> &data);
+    void bump_bootcount(uint32_t which);
+    void generate_token(uint32_t which, uint8_t *token);
+    std::vector<uint8_t> import_records(bool first, bool last, uint8_t p1,
+                                        uint8_t p2,
+                                        const std::vector<uint8_t> &data);
+    std::vector<uint8_t> export_chunk();
+    std::vector<uint8_t> otp_batch_chunk();
+    std::vector<uint8_t> import_chunk();
+    uint16_t response_status() const;
+    uint32_t keyslot_count() const;
+    void move_in_order(uint32_t from, uint32_t to);
+
+    std::string name_;
+    uint8_t seed_[32];
+    std::vector<otpKeySlot_t> keyslots_;
+    // whether each keyslot is in use, the app keeps this as a bitmap
+    std::vector<bool> occupied_;
+    // a permutation of all keyslots, with the ones in use first, in the
+    // order the menus list them
+    std::vector<uint8_t> order_;
+    uint8_t favourite_;
+    uint8_t token_count_;
+    // keyslots whose boot count has already gone up this session
+    std::vector<bool> bumped_;
+
+    std::vector<uint8_t> chain_;
+    bool chain_active_;
+    uint8_t chain_ins_, chain_p1_, chain_p2_;
+
+    Continuation continuation_;
+    uint32_t next_;
+    uint32_t remaining_;
+    uint32_t keyslot_;
+    std::vector<uint32_t> imported_;
+};
+
+#endif
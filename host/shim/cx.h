@@ -0,0 +1,63 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// stands in for the BOLOS SDK's cx.h (see os.h in this directory)
+
+#ifndef SHIM_CX_H
+#define SHIM_CX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CX_LAST (1 << 0)
+#define CX_ENCRYPT (1 << 1)
+#define CX_PAD_NONE 0
+#define CX_CHAIN_ECB 0
+
+typedef enum cx_curve_e { CX_CURVE_SECP256K1 } cx_curve_t;
+
+typedef struct cx_aes_key_s {
+    unsigned int size;
+    unsigned char keys[32];
+} cx_aes_key_t;
+
+int cx_aes_init_key(const unsigned char *raw_key, unsigned int key_len,
+                    cx_aes_key_t *key);
+// only single-block-aligned ECB encryption, which is all the app uses
+int cx_aes(const cx_aes_key_t *key, int mode, const unsigned char *in,
+           unsigned int len, unsigned char *out);
+int cx_hash_sha256(const unsigned char *in, unsigned int len,
+                   unsigned char *out);
+void cx_rng(unsigned char *buffer, unsigned int len);
+unsigned char cx_rng_u8(void);
+
+// not BIP32: the simulated device derives nodes with HMAC-SHA512 over its
+// seed and the path, which is enough to get per-device, per-key secrets
+void os_perso_derive_node_bip32(cx_curve_t curve, const unsigned int *path,
+                                unsigned int path_length,
+                                unsigned char *private_key,
+                                unsigned char *chain);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,37 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// stands in for the glyphs.h that the SDK's build generates from glyphs/
+// (see os.h in this directory)
+
+#ifndef SHIM_GLYPHS_H
+#define SHIM_GLYPHS_H
+
+#include "os_io_seproxyhal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern const bagl_icon_details_t C_icon_back;
+extern const bagl_icon_details_t C_icon_dashboard;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,128 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// stands in for the BOLOS SDK's os.h, so that the app's src/otp.c can be
+// built into the host tool's simulated device. only what otp.c and
+// ctr_drbg.c use is here, implemented in src/sim_sdk.cpp, plus the few
+// definitions src/usb_keyboard.c needs for the keyboard tests, and what
+// src/main.c needs for the app test (implemented in test/app_harness.cpp).
+
+#ifndef SHIM_OS_H
+#define SHIM_OS_H
+
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+// the SDK's os.h declares snprintf()
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EXCEPTION 1
+#define INVALID_PARAMETER 2
+#define EXCEPTION_IO_RESET 0x10
+
+#define CHANNEL_APDU 0
+#define CHANNEL_KEYBOARD 1
+#define CHANNEL_SPI 2
+#define IO_RESET_AFTER_REPLIED 0x80
+#define IO_RETURN_AFTER_TX 0x20
+#define IO_ASYNCH_REPLY 0x10
+#define IO_FLAGS 0xF8
+
+#define U2BE(buf, off) ((uint16_t)(((buf)[off] << 8) | (buf)[(off) + 1]))
+
+#define U4BE(buf, off)                                                         \
+    (((uint32_t)(buf)[off] << 24) | ((uint32_t)(buf)[(off) + 1] << 16) |       \
+     ((uint32_t)(buf)[(off) + 2] << 8) | (uint32_t)(buf)[(off) + 3])
+
+// the app's TRY blocks work as the SDK's do, with setjmp(). THROW() jumps to
+// the innermost one that is open. outside of them, it throws a SimThrow
+// instead, which unwinds into the simulated device's APDU handler, or into
+// the test that called into the app. the C files have to be built with
+// -fexceptions.
+typedef struct sim_try_context_s {
+    jmp_buf env;
+    struct sim_try_context_s *previous;
+    unsigned short ex;
+} sim_try_context_t;
+extern __thread sim_try_context_t *sim_try_context;
+
+void sim_throw(unsigned short exception) __attribute__((noreturn));
+#define THROW(x) sim_throw(x)
+
+#define BEGIN_TRY                                                              \
+    {                                                                          \
+        sim_try_context_t try_context_;                                        \
+        try_context_.previous = sim_try_context;                               \
+        sim_try_context = &try_context_;                                       \
+        try_context_.ex = setjmp(try_context_.env);                            \
+        if (try_context_.ex != 0) {                                            \
+            sim_try_context = try_context_.previous;                           \
+        }
+#define TRY if (try_context_.ex == 0)
+#define CATCH_OTHER(e)                                                         \
+    else for (unsigned short e __attribute__((unused)) = try_context_.ex,      \
+              once_ = 1;                                                       \
+              once_; once_ = 0)
+#define FINALLY
+#define END_TRY                                                                \
+    sim_try_context = try_context_.previous;                                   \
+    }
+#define BEGIN_TRY_L(label) BEGIN_TRY
+#define TRY_L(label) TRY
+#define FINALLY_L(label) FINALLY
+#define END_TRY_L(label) END_TRY
+
+#ifndef __cplusplus
+// src/main.c enables interrupts with this Cortex-M0 instruction, which has
+// nothing to do on the host
+__asm__(".macro cpsie flags\n.endm");
+#endif
+
+#define os_memmove memmove
+#define os_memset memset
+#define os_memcmp memcmp
+
+#define PIC(x) (x)
+#define UNUSED(x) (void)(x)
+// the app's storage is in RAM
+#define WIDE
+
+void nvm_write(void *dst_adr, void *src_adr, unsigned int src_len);
+void os_boot(void);
+void os_sched_exit(unsigned int exit_code);
+void reset(void);
+
+#define IO_APDU_BUFFER_SIZE (5 + 255)
+extern unsigned char G_io_apdu_buffer[IO_APDU_BUFFER_SIZE];
+typedef enum {
+    IO_APDU_MEDIA_NONE,
+    IO_APDU_MEDIA_USB_HID,
+} io_apdu_media_t;
+extern io_apdu_media_t G_io_apdu_media;
+unsigned short io_exchange(unsigned char channel_and_flags,
+                           unsigned short tx_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
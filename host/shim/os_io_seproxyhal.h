@@ -0,0 +1,131 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// stands in for the BOLOS SDK's os_io_seproxyhal.h (see os.h in this
+// directory), with what src/usb_keyboard.c uses, and the menus of
+// src/main.c. the functions are implemented by the tests, in
+// test/keyboard_harness.cpp and test/app_harness.cpp.
+
+#ifndef SHIM_OS_IO_SEPROXYHAL_H
+#define SHIM_OS_IO_SEPROXYHAL_H
+
+#include <stdint.h>
+
+#include "os.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IO_SEPROXYHAL_BUFFER_SIZE_B 128
+
+#define SEPROXYHAL_TAG_FINGER_EVENT 0x01
+#define SEPROXYHAL_TAG_STATUS_EVENT 0x02
+#define SEPROXYHAL_TAG_BUTTON_PUSH_EVENT 0x05
+#define SEPROXYHAL_TAG_DISPLAY_PROCESSED_EVENT 0x0D
+#define SEPROXYHAL_TAG_TICKER_EVENT 0x0E
+#define SEPROXYHAL_TAG_STATUS_EVENT_FLAG_USB_POWERED 0x00000008
+#define SEPROXYHAL_TAG_USB_EP_PREPARE 0x50
+#define SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_IN 0x20
+
+void io_seproxyhal_spi_send(const unsigned char *buffer, unsigned short length);
+unsigned int io_seproxyhal_spi_is_status_sent(void);
+void io_seproxyhal_general_status(void);
+unsigned short io_seproxyhal_spi_recv(unsigned char *buffer,
+                                      unsigned short maxlength,
+                                      unsigned int flags);
+unsigned int io_seproxyhal_handle_event(void);
+unsigned char io_event(unsigned char channel);
+void io_seproxyhal_init(void);
+void USB_power(unsigned char enabled);
+
+// only as much of BAGL and the menus as the app touches. nothing is drawn,
+// the tests look at ux_menu instead.
+typedef struct bagl_component_s {
+    unsigned char type;
+} bagl_component_t;
+typedef struct bagl_element_s {
+    bagl_component_t component;
+    const char *text;
+} bagl_element_t;
+typedef struct bagl_icon_details_s {
+    unsigned int width;
+} bagl_icon_details_t;
+
+void io_seproxyhal_display(const bagl_element_t *element);
+void io_seproxyhal_display_default(bagl_element_t *element);
+
+typedef struct ux_menu_entry_s {
+    const struct ux_menu_entry_s *menu;
+    void (*callback)(unsigned int userid);
+    unsigned int userid;
+    const bagl_icon_details_t *icon;
+    const char *line1;
+    const char *line2;
+    char text_x;
+    char icon_x;
+} ux_menu_entry_t;
+
+typedef const ux_menu_entry_t *(*ux_menu_iterator_t)(unsigned int entry_idx);
+typedef const bagl_element_t *(*ux_menu_preprocessor_t)(
+    const ux_menu_entry_t *entry, bagl_element_t *element);
+
+typedef struct ux_menu_state_s {
+    const ux_menu_entry_t *menu_entries;
+    unsigned int menu_entries_count;
+    unsigned int current_entry;
+    ux_menu_preprocessor_t menu_entry_preprocessor;
+    ux_menu_iterator_t menu_iterator;
+} ux_menu_state_t;
+extern ux_menu_state_t ux_menu;
+
+typedef struct ux_state_s {
+    unsigned int callback_interval_ms;
+} ux_state_t;
+extern ux_state_t ux;
+
+#define UX_MENU_END {NULL, NULL, 0, NULL, NULL, NULL, 0, 0}
+
+// sets ux_menu up the way the SDK does, counting the entries up to
+// UX_MENU_END, and draws it
+void ux_menu_display(unsigned int current_entry,
+                     const ux_menu_entry_t *menu_entries,
+                     ux_menu_preprocessor_t menu_entry_preprocessor);
+void ux_redisplay(void);
+
+#define UX_INIT()
+#define UX_ALLOWED 1
+#define UX_MENU_DISPLAY(current_entry, menu_entries, preprocessor)             \
+    ux_menu_display(current_entry, menu_entries, preprocessor)
+#define UX_REDISPLAY() ux_redisplay()
+#define UX_FINGER_EVENT(seph_packet)
+#define UX_BUTTON_PUSH_EVENT(seph_packet)
+#define UX_DEFAULT_EVENT()
+#define UX_DISPLAYED_EVENT(callback)
+#define UX_TICKER_EVENT(seph_packet, callback)                                 \
+    do {                                                                       \
+        if (ux.callback_interval_ms != 0) {                                    \
+            ux.callback_interval_ms = 0;                                       \
+            callback                                                           \
+        }                                                                      \
+    } while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
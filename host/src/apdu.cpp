@@ -0,0 +1,121 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include "apdu.h"
+
+#include <cstdio>
+
+ApduError::ApduError(uint16_t sw)
+    : std::runtime_error(sw_description(sw)), sw_(sw) {}
+
+static void split_response(const std::vector<uint8_t> &response,
+                           std::vector<uint8_t> &data, uint16_t &sw) {
+    if (response.size() < 2) {
+        throw std::runtime_error("response without a status word");
+    }
+    data.assign(response.begin(), response.end() - 2);
+    sw = (response[response.size() - 2] << 8) | response[response.size() - 1];
+}
+
+std::vector<std::vector<uint8_t>> transmit(Transport &transport, uint8_t ins,
+                                           uint8_t p1, uint8_t p2,
+                                           const std::vector<uint8_t> &data,
+                                           size_t record_length) {
+    std::vector<uint8_t> part;
+    uint16_t sw = 0;
+
+    size_t offset = 0;
+    do {
+        size_t length = data.size() - offset;
+        bool last = length <= APDU_MAX_DATA;
+        if (!last) {
+            length = APDU_MAX_DATA - APDU_MAX_DATA % record_length;
+        }
+
+        std::vector<uint8_t> apdu = {
+            (uint8_t)(last ? CLA : CLA | CLA_CHAINING), ins, p1, p2};
+        if (length > 0) {
+            apdu.push_back(length);
+            apdu.insert(apdu.end(), data.begin() + offset,
+                        data.begin() + offset + length);
+        }
+        offset += length;
+
+        split_response(transport.exchange(apdu), part, sw);
+        if (!last && sw != SW_OK) {
+            throw ApduError(sw);
+        }
+    } while (offset < data.size());
+
+    std::vector<std::vector<uint8_t>> parts;
+    for (;;) {
+        if (sw != SW_OK && (sw & 0xFF00) != SW_BYTES_REMAINING) {
+            throw ApduError(sw);
+        }
+        parts.push_back(part);
+        if (sw == SW_OK) {
+            return parts;
+        }
+        std::vector<uint8_t> get_response = {CLA, INS_GET_RESPONSE, 0, 0};
+        split_response(transport.exchange(get_response), part, sw);
+    }
+}
+
+std::string sw_description(uint16_t sw) {
+    const char *what;
+    switch (sw) {
+    case SW_WRONG_LENGTH:
+        what = "wrong length";
+        break;
+    case SW_LAST_COMMAND_EXPECTED:
+        what = "command chain interrupted";
+        break;
+    case SW_DENIED:
+        what = "rejected on the device";
+        break;
+    case SW_TOKENS_EXHAUSTED:
+        what = "no more tokens this session";
+        break;
+    case SW_WRONG_DATA:
+        what = "data not accepted";
+        break;
+    case SW_KEYSLOT_NOT_FOUND:
+        what = "no such keyslot";
+        break;
+    case SW_NOT_ENOUGH_KEYSLOTS:
+        what = "not enough free keyslots";
+        break;
+    case SW_WRONG_P1P2:
+        what = "wrong P1/P2";
+        break;
+    case SW_NO_RESPONSE_DATA:
+        what = "no response data left";
+        break;
+    case SW_INS_NOT_SUPPORTED:
+        what = "command not supported, is the app running?";
+        break;
+    case SW_CLA_NOT_SUPPORTED:
+        what = "class not supported, is the app running?";
+        break;
+    default:
+        what = "error";
+        break;
+    }
+    char text[64];
+    snprintf(text, sizeof(text), "%s (0x%04X)", what, sw);
+    return text;
+}
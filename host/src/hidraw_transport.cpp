@@ -0,0 +1,169 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include "hidraw_transport.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#define LEDGER_VID 0x2C97
+
+// framing of APDUs in HID reports, as in the SDK's io_usb_hid layer
+#define HID_REPORT_LEN 64
+#define HID_CHANNEL 0x0101
+#define HID_TAG_APDU 0x05
+
+static std::runtime_error system_error(const std::string &what) {
+    return std::runtime_error(what + ": " + strerror(errno));
+}
+
+HidrawTransport::HidrawTransport(const std::string &path, int timeout_ms)
+    : path_(path), timeout_ms_(timeout_ms) {
+    fd_ = open(path.c_str(), O_RDWR);
+    if (fd_ < 0) {
+        throw system_error("can't open " + path);
+    }
+}
+
+HidrawTransport::~HidrawTransport() { close(fd_); }
+
+std::vector<uint8_t>
+HidrawTransport::exchange(const std::vector<uint8_t> &apdu) {
+    send(apdu);
+    return receive();
+}
+
+void HidrawTransport::send(const std::vector<uint8_t> &apdu) {
+    size_t offset = 0;
+    uint16_t sequence = 0;
+    do {
+        // hidraw wants the report ID first, and the interface doesn't use any
+        uint8_t report[1 + HID_REPORT_LEN] = {0};
+        uint8_t *packet = &report[1];
+        size_t header = 5;
+        packet[0] = HID_CHANNEL >> 8;
+        packet[1] = HID_CHANNEL & 0xff;
+        packet[2] = HID_TAG_APDU;
+        packet[3] = sequence >> 8;
+        packet[4] = sequence & 0xff;
+        if (sequence == 0) {
+            packet[5] = apdu.size() >> 8;
+            packet[6] = apdu.size() & 0xff;
+            header += 2;
+        }
+        size_t length =
+            std::min(apdu.size() - offset, (size_t)HID_REPORT_LEN - header);
+        memcpy(&packet[header], &apdu[offset], length);
+        offset += length;
+        sequence++;
+
+        if (write(fd_, report, sizeof(report)) != (ssize_t)sizeof(report)) {
+            throw system_error("can't write to " + path_);
+        }
+    } while (offset < apdu.size());
+}
+
+std::vector<uint8_t> HidrawTransport::receive() {
+    std::vector<uint8_t> response;
+    size_t expected = 0;
+    uint16_t sequence = 0;
+    do {
+        struct pollfd pfd = {fd_, POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout_ms_);
+        if (ready < 0) {
+            throw system_error("can't read from " + path_);
+        }
+        if (ready == 0) {
+            throw std::runtime_error("timed out waiting for " + path_);
+        }
+
+        uint8_t packet[HID_REPORT_LEN];
+        ssize_t got = read(fd_, packet, sizeof(packet));
+        if (got < 0) {
+            throw system_error("can't read from " + path_);
+        }
+        size_t header = sequence == 0 ? 7 : 5;
+        if ((size_t)got < header ||
+            ((packet[0] << 8) | packet[1]) != HID_CHANNEL ||
+            packet[2] != HID_TAG_APDU ||
+            ((packet[3] << 8) | packet[4]) != sequence) {
+            throw std::runtime_error("malformed response from " + path_);
+        }
+        if (sequence == 0) {
+            expected = (packet[5] << 8) | packet[6];
+        }
+        size_t length =
+            std::min(expected - response.size(), (size_t)got - header);
+        response.insert(response.end(), &packet[header],
+                        &packet[header + length]);
+        sequence++;
+    } while (response.size() < expected);
+    return response;
+}
+
+static std::string read_file(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+std::vector<std::string> HidrawTransport::enumerate() {
+    std::vector<std::string> found;
+    DIR *dir = opendir("/sys/class/hidraw");
+    if (dir == NULL) {
+        return found;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "hidraw", 6) != 0) {
+            continue;
+        }
+        std::string device =
+            std::string("/sys/class/hidraw/") + entry->d_name + "/device/";
+
+        // HID_ID=<bus>:<vendor>:<product>
+        std::string uevent = read_file(device + "uevent");
+        size_t id = uevent.find("HID_ID=");
+        unsigned int bus, vendor, product;
+        if (id == std::string::npos ||
+            sscanf(uevent.c_str() + id, "HID_ID=%x:%x:%x", &bus, &vendor,
+                   &product) != 3 ||
+            vendor != LEDGER_VID) {
+            continue;
+        }
+        // the keyboard interface is a Ledger too, skip it: the one we want
+        // starts with the vendor-defined usage page 0xFFA0
+        std::string descriptor = read_file(device + "report_descriptor");
+        if (descriptor.size() < 3 || (uint8_t)descriptor[0] != 0x06 ||
+            (uint8_t)descriptor[1] != 0xA0 || (uint8_t)descriptor[2] != 0xFF) {
+            continue;
+        }
+        found.push_back(std::string("/dev/") + entry->d_name);
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+    return found;
+}
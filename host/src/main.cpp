@@ -0,0 +1,317 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// ledger-otp: talks to any number of devices running the app at once
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hidraw_transport.h"
+#include "otp_client.h"
+#include "simulated_device.h"
+#include "worker_pool.h"
+
+// simulated devices start with this many keyslots
+#define SIMULATED_KEYS 2
+// long enough for the user to confirm on the device
+#define DEFAULT_TIMEOUT_S 60
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options] command [arguments]\n"
+            "\n"
+            "options:\n"
+            "  -d, --device PATH    use this hidraw node (can be repeated),\n"
+            "                       instead of every connected device\n"
+            "  -s, --simulate N     use N simulated devices instead\n"
+            "  -j, --jobs N         talk to at most N devices at once\n"
+            "                       (default: one per CPU)\n"
+            "  -t, --timeout S      give up on a device after S seconds "
+            "(default %d)\n"
+            "\n"
+            "commands:\n"
+            "  list                 show the devices that would be used\n"
+            "  otp SLOT             get a token from a keyslot\n"
+            "  batch SLOT COUNT     get COUNT tokens from a keyslot\n"
+            "  export               list every keyslot's public ID and boot "
+            "count\n"
+            "  import FILE          add keyslots from FILE, one "
+            "\"<public ID> <boot count>\"\n"
+            "                       per line, and print their private IDs\n"
+            "  order                show the favourite keyslot and the order "
+            "the\n"
+            "                       device lists keyslots in\n"
+            "  move SLOT POSITION   list a keyslot at POSITION, 0 being the "
+            "top\n"
+            "  favourite SLOT|none  set or clear the favourite keyslot\n",
+            program, DEFAULT_TIMEOUT_S);
+}
+
+static bool parse_number(const char *text, unsigned long max,
+                         unsigned long &value) {
+    char *end;
+    value = strtoul(text, &end, 0);
+    return *text != '\0' && *end == '\0' && value <= max;
+}
+
+static bool read_import_file(const char *path,
+                             std::vector<ImportRecord> &records) {
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+    std::string line;
+    unsigned int number = 0;
+    while (std::getline(file, line)) {
+        number++;
+        std::istringstream fields(line);
+        std::string public_id;
+        unsigned long boot_count;
+        ImportRecord record;
+        if (!(fields >> public_id)) {
+            continue;
+        }
+        if (!from_modhex(public_id, record.public_id.data(), OTP_PUBLIC_ID_LEN) ||
+            !(fields >> boot_count) || boot_count > 0xFFFF) {
+            fprintf(stderr, "%s:%u: expected a modhex public ID and a boot "
+                            "count\n",
+                    path, number);
+            return false;
+        }
+        record.boot_count = boot_count;
+        records.push_back(record);
+    }
+    return true;
+}
+
+// what one command does with one device, writing what it found to out
+static void run_command(Transport &transport, const std::string &command,
+                        const std::vector<unsigned long> &numbers,
+                        const std::vector<ImportRecord> &records,
+                        std::string &out) {
+    OtpClient client(transport);
+    char line[128];
+    if (command == "list") {
+        out += "\n";
+    } else if (command == "otp") {
+        out += client.get_otp(numbers[0]) + "\n";
+    } else if (command == "batch") {
+        for (const std::vector<uint8_t> &token :
+             client.get_otp_batch(numbers[0], numbers[1])) {
+            out += to_modhex(token.data(), token.size()) + "\n";
+        }
+    } else if (command == "export") {
+        Inventory inventory = client.export_keyslots();
+        snprintf(line, sizeof(line), "%u tokens used this session\n",
+                 inventory.tokens_used);
+        out += line;
+        for (const KeyslotRecord &keyslot : inventory.keyslots) {
+            snprintf(line, sizeof(line), "%3u %s %5u\n", keyslot.index,
+                     to_modhex(keyslot.public_id.data(), OTP_PUBLIC_ID_LEN).c_str(),
+                     keyslot.boot_count);
+            out += line;
+        }
+    } else if (command == "order") {
+        KeyslotOrder order = client.get_keyslot_order();
+        if (order.favourite == KEYSLOT_NONE) {
+            out += "no favourite\n";
+        } else {
+            snprintf(line, sizeof(line), "favourite %u\n", order.favourite);
+            out += line;
+        }
+        for (size_t i = 0; i < order.keyslots.size(); i++) {
+            snprintf(line, sizeof(line), "%3zu: %u\n", i, order.keyslots[i]);
+            out += line;
+        }
+    } else if (command == "move") {
+        client.move_keyslot(numbers[0], numbers[1]);
+    } else if (command == "favourite") {
+        client.set_favourite(numbers[0]);
+    } else if (command == "import") {
+        std::vector<PrivateId> private_ids = client.import_keyslots(records);
+        for (size_t i = 0; i < records.size(); i++) {
+            out += to_modhex(records[i].public_id.data(), OTP_PUBLIC_ID_LEN) + " " +
+                   to_hex(private_ids[i].data(), OTP_PRIVATE_ID_LEN) + "\n";
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+        {"device", required_argument, NULL, 'd'},
+        {"simulate", required_argument, NULL, 's'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"timeout", required_argument, NULL, 't'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    std::vector<std::string> paths;
+    unsigned long simulated = 0;
+    unsigned long jobs = 0;
+    unsigned long timeout_s = DEFAULT_TIMEOUT_S;
+    int option;
+    while ((option = getopt_long(argc, argv, "d:s:j:t:h", options, NULL)) !=
+           -1) {
+        switch (option) {
+        case 'd':
+            paths.push_back(optarg);
+            break;
+        case 's':
+            if (!parse_number(optarg, 100000, simulated) || simulated == 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'j':
+            if (!parse_number(optarg, 1024, jobs) || jobs == 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 't':
+            if (!parse_number(optarg, 3600, timeout_s) || timeout_s == 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return option == 'h' ? 0 : 2;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 2;
+    }
+    std::string command = argv[optind];
+    std::vector<std::string> arguments(argv + optind + 1, argv + argc);
+
+    std::vector<unsigned long> numbers;
+    std::vector<ImportRecord> records;
+    bool arguments_ok;
+    if (command == "list" || command == "export" || command == "order") {
+        arguments_ok = arguments.empty();
+    } else if (command == "otp" || command == "batch") {
+        arguments_ok = arguments.size() == (command == "otp" ? 1u : 2u);
+        for (size_t i = 0; arguments_ok && i < arguments.size(); i++) {
+            unsigned long number;
+            arguments_ok = parse_number(arguments[i].c_str(), 255, number) &&
+                           (i == 0 || number > 0);
+            numbers.push_back(number);
+        }
+    } else if (command == "move") {
+        arguments_ok = arguments.size() == 2;
+        for (size_t i = 0; arguments_ok && i < arguments.size(); i++) {
+            unsigned long number;
+            arguments_ok = parse_number(arguments[i].c_str(), 254, number);
+            numbers.push_back(number);
+        }
+    } else if (command == "favourite") {
+        unsigned long number = KEYSLOT_NONE;
+        arguments_ok = arguments.size() == 1 &&
+                       (arguments[0] == "none" ||
+                        parse_number(arguments[0].c_str(), 254, number));
+        numbers.push_back(number);
+    } else if (command == "import") {
+        arguments_ok = arguments.size() == 1;
+        if (arguments_ok && !read_import_file(arguments[0].c_str(), records)) {
+            return 1;
+        }
+        arguments_ok = arguments_ok && !records.empty();
+    } else {
+        arguments_ok = false;
+    }
+    if (!arguments_ok) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // names of the devices to use, opened by the workers themselves so that
+    // a device that can't be opened doesn't hold up the others
+    std::vector<std::string> names;
+    if (simulated) {
+        for (unsigned long i = 0; i < simulated; i++) {
+            names.push_back("simulated" + std::to_string(i));
+        }
+    } else {
+        names = paths.empty() ? HidrawTransport::enumerate() : paths;
+    }
+    if (names.empty()) {
+        fprintf(stderr, "no devices found\n");
+        return 1;
+    }
+
+    std::vector<std::string> outputs(names.size());
+    std::vector<std::string> errors(names.size());
+    {
+        if (jobs == 0) {
+            // hardware_concurrency() may not know, and says 0
+            jobs = std::max(std::thread::hardware_concurrency(), 1u);
+        }
+        WorkerPool pool(std::min<size_t>(jobs, names.size()));
+        for (size_t i = 0; i < names.size(); i++) {
+            pool.submit([&, i] {
+                try {
+                    std::unique_ptr<Transport> transport;
+                    if (simulated) {
+                        transport.reset(
+                            new SimulatedDevice(names[i], SIMULATED_KEYS));
+                    } else {
+                        transport.reset(
+                            new HidrawTransport(names[i], timeout_s * 1000));
+                    }
+                    run_command(*transport, command, numbers, records,
+                                outputs[i]);
+                } catch (const std::exception &e) {
+                    errors[i] = e.what();
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    // printed once everything is done, so that devices don't interleave
+    int status = 0;
+    for (size_t i = 0; i < names.size(); i++) {
+        if (!errors[i].empty()) {
+            fprintf(stderr, "%s: %s\n", names[i].c_str(), errors[i].c_str());
+            status = 1;
+            continue;
+        }
+        if (command == "list") {
+            printf("%s\n", names[i].c_str());
+            continue;
+        }
+        std::istringstream lines(outputs[i]);
+        std::string line;
+        while (std::getline(lines, line)) {
+            printf("%s: %s\n", names[i].c_str(), line.c_str());
+        }
+    }
+    return status;
+}
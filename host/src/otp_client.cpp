@@ -0,0 +1,183 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include "otp_client.h"
+
+#include <cstring>
+
+extern "C" {
+#include "otp.h"
+}
+
+static std::runtime_error malformed(const char *command) {
+    return std::runtime_error(std::string("malformed ") + command +
+                              " response");
+}
+
+std::string OtpClient::get_otp(uint8_t keyslot) {
+    std::vector<std::vector<uint8_t>> parts =
+        transmit(transport_, INS_GET_OTP, P1_KEYSLOT_INDEX, keyslot, {});
+    if (parts.size() != 1 || parts[0].size() != OTP_TOKEN_LEN) {
+        throw malformed("GET_OTP");
+    }
+    return std::string(parts[0].begin(), parts[0].end());
+}
+
+std::vector<std::vector<uint8_t>> OtpClient::get_otp_batch(uint8_t keyslot,
+                                                           uint8_t count) {
+    std::vector<std::vector<uint8_t>> parts = transmit(
+        transport_, INS_GET_OTP_BATCH, P1_KEYSLOT_INDEX, keyslot, {count});
+
+    // every part starts with a flags byte and its number of tokens
+    std::vector<std::vector<uint8_t>> tokens;
+    for (const std::vector<uint8_t> &part : parts) {
+        if (part.size() < 2 || part.size() != 2u + part[1] * OTP_TOKEN_RAW_LEN) {
+            throw malformed("GET_OTP_BATCH");
+        }
+        for (size_t i = 0; i < part[1]; i++) {
+            const uint8_t *token = &part[2 + i * OTP_TOKEN_RAW_LEN];
+            tokens.emplace_back(token, token + OTP_TOKEN_RAW_LEN);
+        }
+    }
+    return tokens;
+}
+
+Inventory OtpClient::export_keyslots() {
+    Inventory inventory;
+    uint8_t next = 0;
+    // the device continues with GET_RESPONSE by itself, but a response can
+    // still end early, and then the next index says where to pick up
+    do {
+        std::vector<std::vector<uint8_t>> parts =
+            transmit(transport_, INS_EXPORT_KEYSLOTS, next, 0, {});
+        for (const std::vector<uint8_t> &part : parts) {
+            if (part.size() < 2 || (part.size() - 2) % EXPORT_RECORD_LEN) {
+                throw malformed("EXPORT_KEYSLOTS");
+            }
+            inventory.tokens_used = part[0];
+            next = part[1];
+            for (size_t i = 2; i < part.size(); i += EXPORT_RECORD_LEN) {
+                KeyslotRecord record;
+                record.index = part[i];
+                memcpy(record.public_id.data(), &part[i + 1], OTP_PUBLIC_ID_LEN);
+                record.boot_count =
+                    (part[i + 1 + OTP_PUBLIC_ID_LEN] << 8) |
+                    part[i + 1 + OTP_PUBLIC_ID_LEN + 1];
+                inventory.keyslots.push_back(record);
+            }
+        }
+    } while (next != EXPORT_END);
+    return inventory;
+}
+
+std::vector<PrivateId>
+OtpClient::import_keyslots(const std::vector<ImportRecord> &records) {
+    std::vector<PrivateId> private_ids;
+    if (records.empty()) {
+        return private_ids;
+    }
+
+    std::vector<uint8_t> data;
+    for (const ImportRecord &record : records) {
+        data.insert(data.end(), record.public_id.begin(),
+                    record.public_id.end());
+        data.push_back(record.boot_count >> 8);
+        data.push_back(record.boot_count & 0xff);
+    }
+
+    // the app writes the records of each APDU as they arrive, so none may
+    // be split between two
+    std::vector<std::vector<uint8_t>> parts = transmit(
+        transport_, INS_IMPORT_KEYSLOTS, 0, 0, data, IMPORT_RECORD_LEN);
+    std::vector<uint8_t> response;
+    for (const std::vector<uint8_t> &part : parts) {
+        response.insert(response.end(), part.begin(), part.end());
+    }
+    if (response.size() != records.size() * OTP_PRIVATE_ID_LEN) {
+        throw malformed("IMPORT_KEYSLOTS");
+    }
+
+    for (size_t i = 0; i < records.size(); i++) {
+        PrivateId private_id;
+        memcpy(private_id.data(), &response[i * OTP_PRIVATE_ID_LEN],
+               OTP_PRIVATE_ID_LEN);
+        private_ids.push_back(private_id);
+    }
+    return private_ids;
+}
+
+KeyslotOrder OtpClient::get_keyslot_order() {
+    std::vector<std::vector<uint8_t>> parts =
+        transmit(transport_, INS_GET_KEYSLOT_ORDER, 0, 0, {});
+    if (parts.size() != 1 || parts[0].empty()) {
+        throw malformed("GET_KEYSLOT_ORDER");
+    }
+    KeyslotOrder order;
+    order.favourite = parts[0][0];
+    order.keyslots.assign(parts[0].begin() + 1, parts[0].end());
+    return order;
+}
+
+void OtpClient::move_keyslot(uint8_t keyslot, uint8_t position) {
+    std::vector<std::vector<uint8_t>> parts =
+        transmit(transport_, INS_MOVE_KEYSLOT, keyslot, position, {});
+    if (parts.size() != 1 || !parts[0].empty()) {
+        throw malformed("MOVE_KEYSLOT");
+    }
+}
+
+void OtpClient::set_favourite(uint8_t keyslot) {
+    std::vector<std::vector<uint8_t>> parts =
+        transmit(transport_, INS_SET_FAVOURITE, keyslot, 0, {});
+    if (parts.size() != 1 || !parts[0].empty()) {
+        throw malformed("SET_FAVOURITE");
+    }
+}
+
+std::string to_modhex(const uint8_t *bytes, size_t length) {
+    std::string text(2 * length + 1, '\0');
+    bytes_to_modhex((uint8_t *)bytes, length, &text[0]);
+    text.resize(2 * length);
+    return text;
+}
+
+std::string to_hex(const uint8_t *bytes, size_t length) {
+    std::string text(2 * length + 1, '\0');
+    bytes_to_hex((uint8_t *)bytes, length, &text[0]);
+    text.resize(2 * length);
+    return text;
+}
+
+bool from_modhex(const std::string &text, uint8_t *bytes, size_t length) {
+    static const char modhex_alphabet[] = "cbdefghijklnrtuv";
+    if (text.size() != 2 * length) {
+        return false;
+    }
+    for (size_t i = 0; i < 2 * length; i++) {
+        const char *digit = strchr(modhex_alphabet, text[i]);
+        if (text[i] == '\0' || digit == NULL) {
+            return false;
+        }
+        uint8_t value = digit - modhex_alphabet;
+        if (i % 2 == 0) {
+            bytes[i / 2] = value << 4;
+        } else {
+            bytes[i / 2] |= value;
+        }
+    }
+    return true;
+}
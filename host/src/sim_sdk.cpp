@@ -0,0 +1,122 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// the SDK functions declared in shim/, on top of OpenSSL
+
+#include "sim_sdk.h"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include <cstring>
+#include <stdexcept>
+
+extern "C" {
+#include "cx.h"
+#include "os.h"
+}
+
+std::mutex sim_otp_mutex;
+static const uint8_t *sim_seed;
+
+void sim_set_seed(const uint8_t *seed) { sim_seed = seed; }
+
+__thread sim_try_context_t *sim_try_context;
+
+void sim_throw(unsigned short exception) {
+    if (sim_try_context != NULL) {
+        longjmp(sim_try_context->env, exception);
+    }
+    throw SimThrow{exception};
+}
+
+int cx_aes_init_key(const unsigned char *raw_key, unsigned int key_len,
+                    cx_aes_key_t *key) {
+    if (key_len != 16 && key_len != 24 && key_len != 32) {
+        sim_throw(EXCEPTION);
+    }
+    key->size = key_len;
+    memcpy(key->keys, raw_key, key_len);
+    return key_len;
+}
+
+int cx_aes(const cx_aes_key_t *key, int mode, const unsigned char *in,
+           unsigned int len, unsigned char *out) {
+    const EVP_CIPHER *cipher = key->size == 16   ? EVP_aes_128_ecb()
+                               : key->size == 24 ? EVP_aes_192_ecb()
+                                                 : EVP_aes_256_ecb();
+    if (!(mode & CX_ENCRYPT) || len % 16 != 0) {
+        sim_throw(EXCEPTION);
+    }
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    int out_len = 0;
+    bool ok = ctx != NULL &&
+              EVP_EncryptInit_ex(ctx, cipher, NULL, key->keys, NULL) == 1 &&
+              EVP_CIPHER_CTX_set_padding(ctx, 0) == 1 &&
+              EVP_EncryptUpdate(ctx, out, &out_len, in, len) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok) {
+        sim_throw(EXCEPTION);
+    }
+    return len;
+}
+
+int cx_hash_sha256(const unsigned char *in, unsigned int len,
+                   unsigned char *out) {
+    SHA256(in, len, out);
+    return 32;
+}
+
+void cx_rng(unsigned char *buffer, unsigned int len) {
+    if (RAND_bytes(buffer, len) != 1) {
+        sim_throw(EXCEPTION);
+    }
+}
+
+unsigned char cx_rng_u8(void) {
+    unsigned char value;
+    cx_rng(&value, 1);
+    return value;
+}
+
+void os_perso_derive_node_bip32(cx_curve_t curve, const unsigned int *path,
+                                unsigned int path_length,
+                                unsigned char *private_key,
+                                unsigned char *chain) {
+    (void)curve;
+    unsigned char message[4 * 16];
+    if (path_length > 16) {
+        sim_throw(EXCEPTION);
+    }
+    for (unsigned int i = 0; i < path_length; i++) {
+        message[4 * i] = path[i] >> 24;
+        message[4 * i + 1] = path[i] >> 16;
+        message[4 * i + 2] = path[i] >> 8;
+        message[4 * i + 3] = path[i];
+    }
+    unsigned char node[64];
+    unsigned int node_len = sizeof(node);
+    HMAC(EVP_sha512(), sim_seed, 32, message, 4 * path_length, node,
+         &node_len);
+    memcpy(private_key, node, 32);
+    if (chain != NULL) {
+        memcpy(chain, node + 32, 32);
+    }
+    memset(node, 0, sizeof(node));
+}
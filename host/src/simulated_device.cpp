@@ -0,0 +1,511 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include "simulated_device.h"
+
+#include <cstring>
+
+#include "otp_client.h"
+#include "sim_sdk.h"
+
+// same keyslot and session limits as the app, see src/main.c
+
+// the most data a chain other than an import can carry, a GET_OTP_BATCH by
+// public ID, see chain_buffer in src/main.c
+#define CHAIN_MAX_LEN (OTP_PUBLIC_ID_LEN + 1)
+
+SimulatedDevice::SimulatedDevice(const std::string &name,
+                                 uint32_t initial_keys)
+    : name_(name), keyslots_(MAX_OTP_KEYSLOTS),
+      occupied_(MAX_OTP_KEYSLOTS, false), order_(MAX_OTP_KEYSLOTS),
+      favourite_(KEYSLOT_NONE), token_count_(0),
+      bumped_(MAX_OTP_KEYSLOTS, false),
+      chain_active_(false), chain_ins_(0), chain_p1_(0), chain_p2_(0),
+      continuation_(RESPONSE_NONE), next_(0), remaining_(0), keyslot_(0) {
+    cx_rng(seed_, sizeof(seed_));
+    memset(keyslots_.data(), 0, keyslots_.size() * sizeof(otpKeySlot_t));
+    for (uint32_t i = 0; i < MAX_OTP_KEYSLOTS; i++) {
+        order_[i] = i;
+    }
+    for (uint32_t i = 0; i < initial_keys && i < MAX_OTP_KEYSLOTS; i++) {
+        otp_initialize_key(&keyslots_[i]);
+        occupied_[i] = true;
+    }
+}
+
+void SimulatedDevice::restart() {
+    token_count_ = 0;
+    bumped_.assign(MAX_OTP_KEYSLOTS, false);
+    chain_active_ = false;
+    continuation_ = RESPONSE_NONE;
+}
+
+std::vector<uint8_t>
+SimulatedDevice::exchange(const std::vector<uint8_t> &apdu) {
+    std::vector<uint8_t> response;
+    uint16_t sw;
+    try {
+        if (apdu.size() < 4) {
+            sim_throw(SW_WRONG_LENGTH);
+        }
+        uint8_t cla = apdu[0];
+        uint8_t ins = apdu[1];
+        uint8_t p1 = apdu[2];
+        uint8_t p2 = apdu[3];
+        if ((cla & ~CLA_CHAINING) != CLA) {
+            sim_throw(SW_CLA_NOT_SUPPORTED);
+        }
+        // a single byte after the header is Le, which is ignored
+        std::vector<uint8_t> data;
+        if (apdu.size() > 5) {
+            if (apdu.size() != 5u + apdu[4]) {
+                sim_throw(SW_WRONG_LENGTH);
+            }
+            data.assign(apdu.begin() + 5, apdu.end());
+        }
+
+        if (ins != INS_GET_RESPONSE) {
+            continuation_ = RESPONSE_NONE;
+        }
+
+        if (chain_active_ &&
+            (ins != chain_ins_ || p1 != chain_p1_ || p2 != chain_p2_)) {
+            chain_active_ = false;
+            sim_throw(SW_LAST_COMMAND_EXPECTED);
+        }
+        // an import is taken an APDU at a time, as in the app
+        if (ins == INS_IMPORT_KEYSLOTS) {
+            bool first = !chain_active_;
+            chain_active_ = false;
+            response = import_records(first, !(cla & CLA_CHAINING), p1, p2,
+                                      data);
+            if (cla & CLA_CHAINING) {
+                chain_active_ = true;
+                chain_ins_ = ins;
+                chain_p1_ = p1;
+                chain_p2_ = p2;
+                return {SW_OK >> 8, SW_OK & 0xff};
+            }
+            data.clear();
+        } else if ((cla & CLA_CHAINING) || chain_active_) {
+            if (!chain_active_) {
+                chain_active_ = true;
+                chain_.clear();
+                chain_ins_ = ins;
+                chain_p1_ = p1;
+                chain_p2_ = p2;
+            }
+            if (chain_.size() + data.size() > CHAIN_MAX_LEN) {
+                chain_active_ = false;
+                sim_throw(SW_WRONG_LENGTH);
+            }
+            chain_.insert(chain_.end(), data.begin(), data.end());
+            if (cla & CLA_CHAINING) {
+                return {SW_OK >> 8, SW_OK & 0xff};
+            }
+            chain_active_ = false;
+            data.swap(chain_);
+        }
+
+        if (ins != INS_IMPORT_KEYSLOTS) {
+            response = handle(ins, p1, p2, data);
+        }
+        sw = response_status();
+    } catch (const SimThrow &e) {
+        response.clear();
+        switch (e.exception & 0xF000) {
+        case 0x6000:
+        case 0x9000:
+            sw = e.exception;
+            break;
+        default:
+            sw = 0x6800 | (e.exception & 0x7FF);
+            break;
+        }
+    }
+    response.push_back(sw >> 8);
+    response.push_back(sw & 0xff);
+    return response;
+}
+
+std::vector<uint8_t> SimulatedDevice::handle(uint8_t ins, uint8_t p1,
+                                             uint8_t p2,
+                                             const std::vector<uint8_t> &data) {
+    switch (ins) {
+    case INS_GET_OTP:
+    case INS_GET_OTP_BATCH: {
+        std::vector<uint8_t> selector = data;
+        uint32_t count = (APDU_BUFFER_SIZE - 2 - 2) / OTP_TOKEN_RAW_LEN;
+        if (ins == INS_GET_OTP_BATCH &&
+            selector.size() ==
+                (p1 == P1_KEYSLOT_PUBLIC_ID ? OTP_PUBLIC_ID_LEN : 0) + 1u) {
+            count = selector.back();
+            selector.pop_back();
+            if (count == 0) {
+                sim_throw(SW_WRONG_DATA);
+            }
+        }
+        uint32_t which = select_keyslot(p1, p2, selector);
+        if (token_count_ == 255) {
+            sim_throw(SW_TOKENS_EXHAUSTED);
+        }
+        // src/main.c bumps it while generating the first token, after the
+        // request has been approved
+        bump_bootcount(which);
+
+        if (ins == INS_GET_OTP) {
+            uint8_t token[OTP_TOKEN_RAW_LEN];
+            generate_token(which, token);
+            std::string printable = to_modhex(token, sizeof(token));
+            return std::vector<uint8_t>(printable.begin(), printable.end());
+        }
+        continuation_ = RESPONSE_OTP_BATCH;
+        keyslot_ = which;
+        remaining_ = count;
+        return otp_batch_chunk();
+    }
+
+    case INS_EXPORT_KEYSLOTS:
+        if (p2 != 0) {
+            sim_throw(SW_WRONG_P1P2);
+        }
+        if (!data.empty()) {
+            sim_throw(SW_WRONG_LENGTH);
+        }
+        continuation_ = RESPONSE_EXPORT;
+        next_ = p1;
+        return export_chunk();
+
+    case INS_GET_KEYSLOT_ORDER: {
+        if (p1 != 0 || p2 != 0) {
+            sim_throw(SW_WRONG_P1P2);
+        }
+        if (!data.empty()) {
+            sim_throw(SW_WRONG_LENGTH);
+        }
+        uint8_t favourite = favourite_;
+        if (favourite != KEYSLOT_NONE && !occupied_[favourite]) {
+            favourite = KEYSLOT_NONE;
+        }
+        std::vector<uint8_t> response(1, favourite);
+        response.insert(response.end(), order_.begin(),
+                        order_.begin() + keyslot_count());
+        return response;
+    }
+
+    case INS_MOVE_KEYSLOT: {
+        if (!data.empty()) {
+            sim_throw(SW_WRONG_LENGTH);
+        }
+        if (p1 >= MAX_OTP_KEYSLOTS || !occupied_[p1]) {
+            sim_throw(SW_KEYSLOT_NOT_FOUND);
+        }
+        if (p2 >= keyslot_count()) {
+            sim_throw(SW_WRONG_P1P2);
+        }
+        uint32_t from = 0;
+        while (order_[from] != p1) {
+            from++;
+        }
+        move_in_order(from, p2);
+        return {};
+    }
+
+    case INS_SET_FAVOURITE:
+        if (p2 != 0) {
+            sim_throw(SW_WRONG_P1P2);
+        }
+        if (!data.empty()) {
+            sim_throw(SW_WRONG_LENGTH);
+        }
+        if (p1 != KEYSLOT_NONE && (p1 >= MAX_OTP_KEYSLOTS || !occupied_[p1])) {
+            sim_throw(SW_KEYSLOT_NOT_FOUND);
+        }
+        favourite_ = p1;
+        return {};
+
+    case INS_GET_RESPONSE:
+        if (p1 != 0 || p2 != 0) {
+            sim_throw(SW_WRONG_P1P2);
+        }
+        if (!data.empty()) {
+            sim_throw(SW_WRONG_LENGTH);
+        }
+        switch (continuation_) {
+        case RESPONSE_EXPORT:
+            return export_chunk();
+        case RESPONSE_OTP_BATCH:
+            return otp_batch_chunk();
+        case RESPONSE_IMPORT:
+            return import_chunk();
+        default:
+            sim_throw(SW_NO_RESPONSE_DATA);
+        }
+
+    default:
+        sim_throw(SW_INS_NOT_SUPPORTED);
+    }
+}
+
+uint32_t SimulatedDevice::select_keyslot(uint8_t p1, uint8_t p2,
+                                         const std::vector<uint8_t> &data) {
+    switch (p1) {
+    case P1_KEYSLOT_INDEX:
+        if (!data.empty()) {
+            sim_throw(SW_WRONG_LENGTH);
+        }
+        if (p2 >= MAX_OTP_KEYSLOTS || !occupied_[p2]) {
+            sim_throw(SW_KEYSLOT_NOT_FOUND);
+        }
+        return p2;
+    case P1_KEYSLOT_PUBLIC_ID:
+        if (p2 != 0) {
+            sim_throw(SW_WRONG_P1P2);
+        }
+        if (data.size() != OTP_PUBLIC_ID_LEN) {
+            sim_throw(SW_WRONG_LENGTH);
+        }
+        for (uint32_t i = 0; i < MAX_OTP_KEYSLOTS; i++) {
+            if (occupied_[i] &&
+                memcmp(keyslots_[i].public_id, data.data(),
+                       OTP_PUBLIC_ID_LEN) == 0) {
+                return i;
+            }
+        }
+        sim_throw(SW_KEYSLOT_NOT_FOUND);
+    default:
+        sim_throw(SW_WRONG_P1P2);
+    }
+}
+
+// as in src/main.c, where the exception this throws at 0xFFFF is answered
+// with SW_DENIED by the approve callbacks
+void SimulatedDevice::bump_bootcount(uint32_t which) {
+    if (bumped_[which]) {
+        return;
+    }
+    if (keyslots_[which].boot_count == 0xFFFF) {
+        sim_throw(SW_DENIED);
+    }
+    keyslots_[which].boot_count++;
+    bumped_[which] = true;
+}
+
+void SimulatedDevice::generate_token(uint32_t which, uint8_t *token) {
+    std::lock_guard<std::mutex> lock(sim_otp_mutex);
+    sim_set_seed(seed_);
+    token_count_since_boot = token_count_;
+
+    otpKeySecrets_t secrets;
+    cx_aes_key_t aes_key;
+    otp_derive_keys(&keyslots_[which], &secrets);
+    cx_aes_init_key(secrets.aes_key, OTP_AES_KEY_LEN, &aes_key);
+    otp_generate_token_raw(&keyslots_[which], &secrets, &aes_key, token);
+    memset(&secrets, 0, sizeof(secrets));
+    memset(&aes_key, 0, sizeof(aes_key));
+
+    token_count_ = token_count_since_boot;
+}
+
+std::vector<uint8_t> SimulatedDevice::export_chunk() {
+    std::vector<uint8_t> response(2);
+    uint32_t i;
+    for (i = next_; i < MAX_OTP_KEYSLOTS; i++) {
+        if (!occupied_[i]) {
+            continue;
+        }
+        const otpKeySlot_t &key = keyslots_[i];
+        if (response.size() + EXPORT_RECORD_LEN > APDU_BUFFER_SIZE - 2) {
+            break;
+        }
+        response.push_back(i);
+        response.insert(response.end(), key.public_id,
+                        key.public_id + OTP_PUBLIC_ID_LEN);
+        response.push_back(key.boot_count >> 8);
+        response.push_back(key.boot_count & 0xff);
+    }
+    response[0] = token_count_;
+    response[1] = i < MAX_OTP_KEYSLOTS ? i : EXPORT_END;
+
+    next_ = i;
+    if (i >= MAX_OTP_KEYSLOTS) {
+        continuation_ = RESPONSE_NONE;
+    }
+    return response;
+}
+
+std::vector<uint8_t> SimulatedDevice::otp_batch_chunk() {
+    uint32_t count = (APDU_BUFFER_SIZE - 2 - 2) / OTP_TOKEN_RAW_LEN;
+    if (count > remaining_) {
+        count = remaining_;
+    }
+    if (count > 255u - token_count_) {
+        count = 255 - token_count_;
+    }
+
+    // the whole chunk from one otp_generate_tokens(), which derives the
+    // keyslot's secrets once rather than per token
+    std::string printable(count * OTP_TOKEN_LEN + 1, '\0');
+    {
+        std::lock_guard<std::mutex> lock(sim_otp_mutex);
+        sim_set_seed(seed_);
+        token_count_since_boot = token_count_;
+        otp_generate_tokens(&keyslots_[keyslot_], count, &printable[0]);
+        token_count_ = token_count_since_boot;
+    }
+
+    std::vector<uint8_t> response(2 + count * OTP_TOKEN_RAW_LEN);
+    for (uint32_t i = 0; i < count; i++) {
+        from_modhex(printable.substr(i * OTP_TOKEN_LEN, OTP_TOKEN_LEN),
+                    &response[2 + i * OTP_TOKEN_RAW_LEN], OTP_TOKEN_RAW_LEN);
+    }
+    // the flag for running low on tokens, as in src/main.c
+    response[0] = 255 - token_count_ < 32 ? 0x01 : 0;
+    response[1] = count;
+
+    remaining_ -= count;
+    if (remaining_ == 0 || token_count_ == 255) {
+        continuation_ = RESPONSE_NONE;
+    }
+    return response;
+}
+
+// the records are kept in free keyslots until the last APDU of the import,
+// which makes them appear, as approving it does in the app
+std::vector<uint8_t>
+SimulatedDevice::import_records(bool first, bool last, uint8_t p1,
+                                uint8_t p2, const std::vector<uint8_t> &data) {
+    if (p1 != 0 || p2 != 0) {
+        sim_throw(SW_WRONG_P1P2);
+    }
+    if (data.size() % IMPORT_RECORD_LEN != 0) {
+        sim_throw(SW_WRONG_LENGTH);
+    }
+    if (first) {
+        imported_.clear();
+    }
+
+    for (size_t record = 0; record < data.size();
+         record += IMPORT_RECORD_LEN) {
+        const uint8_t *public_id = &data[record];
+        if (public_id[OTP_PUBLIC_ID_LEN] == 0xFF &&
+            public_id[OTP_PUBLIC_ID_LEN + 1] == 0xFF) {
+            sim_throw(SW_WRONG_DATA);
+        }
+        for (uint32_t i = 0; i < MAX_OTP_KEYSLOTS; i++) {
+            if (occupied_[i] && memcmp(keyslots_[i].public_id, public_id,
+                                       OTP_PUBLIC_ID_LEN) == 0) {
+                sim_throw(SW_WRONG_DATA);
+            }
+        }
+        for (uint32_t where : imported_) {
+            if (memcmp(keyslots_[where].public_id, public_id,
+                       OTP_PUBLIC_ID_LEN) == 0) {
+                sim_throw(SW_WRONG_DATA);
+            }
+        }
+        for (size_t i = 0; i < record; i += IMPORT_RECORD_LEN) {
+            if (memcmp(&data[i], public_id, OTP_PUBLIC_ID_LEN) == 0) {
+                sim_throw(SW_WRONG_DATA);
+            }
+        }
+    }
+    uint32_t count = keyslot_count();
+    if (count + imported_.size() + data.size() / IMPORT_RECORD_LEN >
+        MAX_OTP_KEYSLOTS) {
+        sim_throw(SW_NOT_ENOUGH_KEYSLOTS);
+    }
+
+    for (size_t record = 0; record < data.size();
+         record += IMPORT_RECORD_LEN) {
+        uint32_t where = order_[count + imported_.size()];
+        memcpy(keyslots_[where].public_id, &data[record], OTP_PUBLIC_ID_LEN);
+        keyslots_[where].boot_count = (data[record + OTP_PUBLIC_ID_LEN] << 8) |
+                                      data[record + OTP_PUBLIC_ID_LEN + 1];
+        imported_.push_back(where);
+    }
+
+    if (!last) {
+        return {};
+    }
+    if (imported_.empty()) {
+        sim_throw(SW_WRONG_LENGTH);
+    }
+    for (uint32_t where : imported_) {
+        occupied_[where] = true;
+        bumped_[where] = false;
+    }
+    continuation_ = RESPONSE_IMPORT;
+    next_ = 0;
+    return import_chunk();
+}
+
+std::vector<uint8_t> SimulatedDevice::import_chunk() {
+    std::vector<uint8_t> response;
+    std::lock_guard<std::mutex> lock(sim_otp_mutex);
+    sim_set_seed(seed_);
+    while (next_ < imported_.size() &&
+           response.size() + OTP_PRIVATE_ID_LEN <= APDU_BUFFER_SIZE - 2) {
+        otpKeySecrets_t secrets;
+        otp_derive_keys(&keyslots_[imported_[next_]], &secrets);
+        response.insert(response.end(), secrets.private_id,
+                        secrets.private_id + OTP_PRIVATE_ID_LEN);
+        memset(&secrets, 0, sizeof(secrets));
+        next_++;
+    }
+    if (next_ == imported_.size()) {
+        continuation_ = RESPONSE_NONE;
+    }
+    return response;
+}
+
+uint32_t SimulatedDevice::keyslot_count() const {
+    uint32_t count = 0;
+    while (count < MAX_OTP_KEYSLOTS && occupied_[order_[count]]) {
+        count++;
+    }
+    return count;
+}
+
+void SimulatedDevice::move_in_order(uint32_t from, uint32_t to) {
+    uint8_t which = order_[from];
+    order_.erase(order_.begin() + from);
+    order_.insert(order_.begin() + to, which);
+}
+
+uint16_t SimulatedDevice::response_status() const {
+    uint32_t remaining;
+    switch (continuation_) {
+    case RESPONSE_EXPORT:
+        remaining = 2;
+        for (uint32_t i = next_; i < MAX_OTP_KEYSLOTS; i++) {
+            if (occupied_[i]) {
+                remaining += EXPORT_RECORD_LEN;
+            }
+        }
+        break;
+    case RESPONSE_OTP_BATCH:
+        remaining = 2 + remaining_ * OTP_TOKEN_RAW_LEN;
+        break;
+    case RESPONSE_IMPORT:
+        remaining = (imported_.size() - next_) * OTP_PRIVATE_ID_LEN;
+        break;
+    default:
+        return SW_OK;
+    }
+    return SW_BYTES_REMAINING | (remaining > 0xFF ? 0 : remaining);
+}
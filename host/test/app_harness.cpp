@@ -0,0 +1,242 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+#include "app_harness.h"
+
+#include <cstring>
+
+#include "sim_sdk.h"
+
+extern "C" {
+#include "os.h"
+#include "os_io_seproxyhal.h"
+#include "glyphs.h"
+#include "usb_keyboard.h"
+
+int app_main(void);
+void sample_main(void);
+
+unsigned char G_io_apdu_buffer[IO_APDU_BUFFER_SIZE];
+io_apdu_media_t G_io_apdu_media = IO_APDU_MEDIA_USB_HID;
+ux_menu_state_t ux_menu;
+const bagl_icon_details_t C_icon_back = {};
+const bagl_icon_details_t C_icon_dashboard = {};
+}
+
+// what io_exchange() throws when the app waits for an APDU that the test
+// hasn't sent, to get back to the test
+struct AppIdle {};
+
+static uint8_t seed[32] = {0x79, 0x75, 0x62, 0x69};
+static std::vector<uint8_t> pending_apdu;
+static bool apdu_pending;
+static std::vector<uint8_t> response;
+static std::vector<uint8_t> confirmed_response;
+static uint32_t nvm_writes;
+
+// runs the app until it waits for the next APDU
+template <typename Function>
+static void run_app(Function function) {
+    sim_set_seed(seed);
+    try {
+        function();
+    } catch (const AppIdle &) {
+    }
+    // the TRY blocks that were open are gone
+    sim_try_context = NULL;
+}
+
+void app_start() {
+    apdu_pending = false;
+    run_app(app_main);
+}
+
+std::vector<uint8_t> app_exchange(const std::vector<uint8_t> &apdu) {
+    pending_apdu = apdu;
+    apdu_pending = true;
+    response.clear();
+    run_app(sample_main);
+    return response;
+}
+
+std::vector<uint8_t> app_confirmed_response() {
+    return confirmed_response;
+}
+
+void app_tick(uint32_t ticks) {
+    sim_set_seed(seed);
+    for (uint32_t i = 0; i < ticks; i++) {
+        extern unsigned char G_io_seproxyhal_spi_buffer[];
+        G_io_seproxyhal_spi_buffer[0] = SEPROXYHAL_TAG_TICKER_EVENT;
+        io_event(CHANNEL_SPI);
+    }
+}
+
+static const ux_menu_entry_t *menu_entry(uint32_t entry) {
+    if (ux_menu.menu_iterator != NULL) {
+        return ux_menu.menu_iterator(entry);
+    }
+    return &ux_menu.menu_entries[entry];
+}
+
+void app_highlight(uint32_t entry) {
+    ux_menu.current_entry = entry;
+    ux_redisplay();
+}
+
+void app_select_highlighted() {
+    sim_set_seed(seed);
+    const ux_menu_entry_t *entry = menu_entry(ux_menu.current_entry);
+    if (entry->menu != NULL) {
+        ux_menu_display(entry->userid, entry->menu, NULL);
+    } else if (entry->callback != NULL) {
+        entry->callback(entry->userid);
+    }
+}
+
+bool app_select(const char *line1) {
+    for (uint32_t i = 0; i < ux_menu.menu_entries_count; i++) {
+        const char *text = menu_entry(i)->line1;
+        if (text != NULL && strcmp(text, line1) == 0) {
+            app_highlight(i);
+            app_select_highlighted();
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t app_nvm_writes() {
+    return nvm_writes;
+}
+
+// the SDK
+
+void nvm_write(void *dst_adr, void *src_adr, unsigned int src_len) {
+    if (src_adr == NULL) {
+        memset(dst_adr, 0, src_len);
+    } else {
+        memmove(dst_adr, src_adr, src_len);
+    }
+    nvm_writes++;
+}
+
+void os_boot(void) {}
+
+void os_sched_exit(unsigned int exit_code) {
+    (void)exit_code;
+    throw AppIdle();
+}
+
+void reset(void) {}
+
+void io_seproxyhal_init(void) {}
+
+void USB_power(unsigned char enabled) {
+    (void)enabled;
+}
+
+unsigned short io_exchange(unsigned char channel_and_flags,
+                           unsigned short tx_len) {
+    if (channel_and_flags & IO_RETURN_AFTER_TX) {
+        // the reply to an APDU that was confirmed on the device
+        confirmed_response.assign(G_io_apdu_buffer,
+                                  G_io_apdu_buffer + tx_len);
+        return 0;
+    }
+    if (tx_len != 0 && !(channel_and_flags & IO_ASYNCH_REPLY)) {
+        response.assign(G_io_apdu_buffer, G_io_apdu_buffer + tx_len);
+    }
+    if (!apdu_pending) {
+        throw AppIdle();
+    }
+    apdu_pending = false;
+    memcpy(G_io_apdu_buffer, pending_apdu.data(), pending_apdu.size());
+    return pending_apdu.size();
+}
+
+// keyboard reports are acknowledged whenever the keyboard waits for room in
+// its queue, as in keyboard_harness.cpp
+
+void io_seproxyhal_spi_send(const unsigned char *buffer,
+                            unsigned short length) {
+    (void)buffer;
+    (void)length;
+}
+
+unsigned int io_seproxyhal_spi_is_status_sent(void) {
+    return 1;
+}
+
+void io_seproxyhal_general_status(void) {}
+
+unsigned short io_seproxyhal_spi_recv(unsigned char *buffer,
+                                      unsigned short maxlength,
+                                      unsigned int flags) {
+    (void)flags;
+    memset(buffer, 0, maxlength);
+    return 3;
+}
+
+unsigned int io_seproxyhal_handle_event(void) {
+    usb_kbd_report_sent();
+    return 1;
+}
+
+// the menus, as far as the app can tell
+
+void io_seproxyhal_display_default(bagl_element_t *element) {
+    (void)element;
+}
+
+void ux_menu_display(unsigned int current_entry,
+                     const ux_menu_entry_t *menu_entries,
+                     ux_menu_preprocessor_t menu_entry_preprocessor) {
+    static const ux_menu_entry_t end = UX_MENU_END;
+    ux_menu.menu_entries_count = 0;
+    if (menu_entries != NULL) {
+        while (memcmp(&menu_entries[ux_menu.menu_entries_count], &end,
+                      sizeof(end)) != 0) {
+            ux_menu.menu_entries_count++;
+        }
+    }
+    ux_menu.menu_entries = menu_entries;
+    ux_menu.current_entry = current_entry;
+    ux_menu.menu_entry_preprocessor = menu_entry_preprocessor;
+    ux_menu.menu_iterator = NULL;
+    ux_redisplay();
+}
+
+// draws the highlighted entry and its neighbours, the way the SDK asks the
+// app for them
+void ux_redisplay(void) {
+    if (ux_menu.menu_entries_count == 0) {
+        return;
+    }
+    if (ux_menu.menu_iterator != NULL) {
+        if (ux_menu.current_entry > 0) {
+            ux_menu.menu_iterator(ux_menu.current_entry - 1);
+        }
+        ux_menu.menu_iterator(ux_menu.current_entry);
+        if (ux_menu.current_entry + 1 < ux_menu.menu_entries_count) {
+            ux_menu.menu_iterator(ux_menu.current_entry + 1);
+        }
+    }
+    bagl_element_t element = {};
+    io_seproxyhal_display(&element);
+}
@@ -0,0 +1,55 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+#ifndef HOST_TEST_APP_HARNESS_H
+#define HOST_TEST_APP_HARNESS_H
+
+#include <cstdint>
+#include <vector>
+
+// runs the app's src/main.c on the host, with the SDK functions it calls
+// implemented in app_harness.cpp. the test plays both the user and the host:
+// it starts the app, lets the ticker run, moves through the menus and sends
+// APDUs. nothing is drawn, the menus are read from ux_menu.
+// the app keeps its state in globals, so there is one app per test program.
+
+// starts the app, as if the device had just been plugged in. storage is kept
+// from the previous start, so the first start finds it empty and resets it.
+void app_start();
+
+// sends an APDU and returns the response, status word last. if the app asks
+// for confirmation on the device first, nothing is returned, and the
+// response comes with app_confirmed_response() once an entry is selected.
+std::vector<uint8_t> app_exchange(const std::vector<uint8_t> &apdu);
+std::vector<uint8_t> app_confirmed_response();
+
+// ticker events, every 100 ms on the device
+void app_tick(uint32_t ticks);
+
+// moves the highlight of the current menu to entry, as the buttons would
+void app_highlight(uint32_t entry);
+// selects the highlighted entry, as pressing both buttons would
+void app_select_highlighted();
+// highlights and selects the entry of the current menu whose first line is
+// line1. returns false if there is none.
+bool app_select(const char *line1);
+
+// calls to nvm_write() since the program started
+uint32_t app_nvm_writes();
+
+#endif
@@ -0,0 +1,212 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+// runs the app itself, src/main.c, through what the simulated device
+// doesn't cover: the menus, what happens while they sit idle, and
+// confirming an import on the device.
+// exits with 1 if anything is off.
+
+#include <algorithm>
+#include <cstdio>
+
+#include "apdu.h"
+#include "app_harness.h"
+#include "otp_client.h"
+
+#define KEYS 3
+// more than fit into one APDU
+#define IMPORT_KEYS 40
+// enough for the idle work to get through everything it does for a keyslot
+#define IDLE_TICKS 5
+
+static int failures;
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition);    \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+static void add_keys(uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        CHECK(app_select("New random key"));
+        CHECK(app_select("Done"));
+    }
+}
+
+// the idle work gets the highlighted keyslot ready to type, which mustn't
+// use up tokens (or write its boot count) for the keyslots scrolled past
+static void test_scrolling() {
+    app_start();
+    CHECK(app_select("OTP keys"));
+    uint32_t nvm_writes = app_nvm_writes();
+    for (uint32_t round = 0; round < 2; round++) {
+        for (uint32_t entry = 0; entry < KEYS; entry++) {
+            app_highlight(entry);
+            app_tick(IDLE_TICKS);
+        }
+    }
+    CHECK(otp_tokens_used() == 0);
+    CHECK(app_nvm_writes() == nvm_writes);
+
+    // typing a token uses up exactly one, and scrolling past the keyslot
+    // afterwards, now that its boot count has gone up, none
+    app_highlight(1);
+    app_tick(IDLE_TICKS);
+    app_select_highlighted();
+    CHECK(otp_tokens_used() == 1);
+    for (uint32_t entry = 0; entry < KEYS; entry++) {
+        app_highlight(entry);
+        app_tick(IDLE_TICKS);
+    }
+    CHECK(otp_tokens_used() == 1);
+
+    // the same for the favourite, highlighted in the main menu
+    CHECK(app_select("Back"));
+    CHECK(app_select("Arrange keys"));
+    CHECK(app_select("Set favourite"));
+    app_highlight(2);
+    app_select_highlighted();
+    app_tick(IDLE_TICKS);
+    app_highlight(1);
+    app_tick(IDLE_TICKS);
+    app_highlight(0);
+    app_tick(IDLE_TICKS);
+    CHECK(otp_tokens_used() == 1);
+}
+
+// the number of keyslots GET_KEYSLOT_ORDER lists
+static size_t keys_listed() {
+    std::vector<uint8_t> response =
+        app_exchange({CLA, INS_GET_KEYSLOT_ORDER, 0, 0});
+    CHECK(response.size() >= 3 && response[response.size() - 2] == 0x90);
+    return response.size() - 3;
+}
+
+// the APDUs of an IMPORT_KEYSLOTS of count new keys, chained as the host
+// tool sends them
+static std::vector<std::vector<uint8_t>> import_apdus(uint32_t count) {
+    std::vector<std::vector<uint8_t>> apdus;
+    const uint32_t per_apdu = APDU_MAX_DATA / IMPORT_RECORD_LEN;
+    for (uint32_t first = 0; first < count; first += per_apdu) {
+        uint32_t records = std::min(count - first, per_apdu);
+        std::vector<uint8_t> apdu = {
+            (uint8_t)(first + records < count ? CLA | CLA_CHAINING : CLA),
+            INS_IMPORT_KEYSLOTS, 0, 0, (uint8_t)(records * IMPORT_RECORD_LEN)};
+        for (uint32_t i = first; i < first + records; i++) {
+            apdu.insert(apdu.end(), {0x7a, 0x7a, 0, 0, 0, (uint8_t)i, 0, 1});
+        }
+        apdus.push_back(apdu);
+    }
+    return apdus;
+}
+
+// the data of a response and of the parts after it, fetched with
+// GET_RESPONSE
+static std::vector<std::vector<uint8_t>>
+response_parts(std::vector<uint8_t> response) {
+    std::vector<std::vector<uint8_t>> parts;
+    while (response.size() >= 2) {
+        uint8_t sw1 = response[response.size() - 2];
+        parts.emplace_back(response.begin(), response.end() - 2);
+        if (sw1 != 0x61) {
+            CHECK(sw1 == 0x90);
+            break;
+        }
+        response = app_exchange({CLA, INS_GET_RESPONSE, 0, 0});
+    }
+    return parts;
+}
+
+// the records of an import go into free keyslots as they arrive, and only
+// appear once the user has approved the whole import
+static void test_import() {
+    app_start();
+    std::vector<std::vector<uint8_t>> apdus = import_apdus(IMPORT_KEYS);
+    CHECK(apdus.size() > 1);
+    size_t keys = keys_listed();
+
+    // rejected
+    for (size_t i = 0; i + 1 < apdus.size(); i++) {
+        CHECK(app_exchange(apdus[i]) == std::vector<uint8_t>({0x90, 0x00}));
+    }
+    CHECK(app_exchange(apdus.back()).empty());
+    CHECK(app_select("Reject"));
+    CHECK(app_confirmed_response() == std::vector<uint8_t>({0x69, 0x85}));
+    CHECK(keys_listed() == keys);
+
+    // interrupted by a key added on the device, which could have taken one
+    // of the keyslots the import had written to
+    CHECK(app_exchange(apdus[0]) == std::vector<uint8_t>({0x90, 0x00}));
+    add_keys(1);
+    keys++;
+    CHECK(app_exchange(apdus.back()) ==
+          std::vector<uint8_t>({0x68, 0x83}));
+    CHECK(keys_listed() == keys);
+
+    // approved, the same public IDs, which the rejected import didn't use
+    // up. the free keyslots are consecutive, so each APDU's records take one
+    // write, and the bitmap one more.
+    uint32_t nvm_writes = app_nvm_writes();
+    for (size_t i = 0; i + 1 < apdus.size(); i++) {
+        CHECK(app_exchange(apdus[i]) == std::vector<uint8_t>({0x90, 0x00}));
+    }
+    CHECK(app_exchange(apdus.back()).empty());
+    CHECK(app_select("Approve"));
+    CHECK(app_nvm_writes() - nvm_writes == apdus.size() + 1);
+    size_t private_ids = 0;
+    for (const std::vector<uint8_t> &part :
+         response_parts(app_confirmed_response())) {
+        private_ids += part.size();
+    }
+    CHECK(private_ids == IMPORT_KEYS * OTP_PRIVATE_ID_LEN);
+    CHECK(keys_listed() == keys + IMPORT_KEYS);
+
+    // and they come back out with the boot count they went in with
+    uint32_t found = 0;
+    for (const std::vector<uint8_t> &part :
+         response_parts(app_exchange({CLA, INS_EXPORT_KEYSLOTS, 0, 0}))) {
+        for (size_t record = 2; record + EXPORT_RECORD_LEN <= part.size();
+             record += EXPORT_RECORD_LEN) {
+            const uint8_t *public_id = &part[record + 1];
+            if (public_id[0] == 0x7a && public_id[1] == 0x7a) {
+                CHECK(public_id[OTP_PUBLIC_ID_LEN] == 0 &&
+                      public_id[OTP_PUBLIC_ID_LEN + 1] == 1);
+                found++;
+            }
+        }
+    }
+    CHECK(found == IMPORT_KEYS);
+}
+
+int main() {
+    app_start();
+    add_keys(KEYS);
+
+    test_scrolling();
+    test_import();
+
+    if (failures) {
+        fprintf(stderr, "app_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("app_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include "keyboard_harness.h"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include "os_io_seproxyhal.h"
+#include "usb_keyboard.h"
+
+unsigned char G_io_seproxyhal_spi_buffer[IO_SEPROXYHAL_BUFFER_SIZE_B];
+}
+
+#define KEY_ENTER 40
+
+static std::vector<KeyboardReport> received;
+
+// the SDK functions src/usb_keyboard.c calls. the only event it ever
+// receives is the acknowledgment of the report in flight.
+
+void io_seproxyhal_spi_send(const unsigned char *buffer,
+                            unsigned short length) {
+    if (length == 6 + sizeof(KeyboardReport) &&
+        buffer[0] == SEPROXYHAL_TAG_USB_EP_PREPARE) {
+        KeyboardReport report;
+        memcpy(report.data(), &buffer[6], report.size());
+        received.push_back(report);
+    }
+}
+
+unsigned int io_seproxyhal_spi_is_status_sent(void) {
+    return 1;
+}
+
+void io_seproxyhal_general_status(void) {}
+
+unsigned short io_seproxyhal_spi_recv(unsigned char *buffer,
+                                      unsigned short maxlength,
+                                      unsigned int flags) {
+    (void)flags;
+    memset(buffer, 0, maxlength);
+    return 3;
+}
+
+unsigned int io_seproxyhal_handle_event(void) {
+    usb_kbd_report_sent();
+    return 1;
+}
+
+unsigned char io_event(unsigned char channel) {
+    (void)channel;
+    return 1;
+}
+
+std::string modhex(const std::vector<uint8_t> &bytes) {
+    static const char modhex_alphabet[] = "cbdefghijklnrtuv";
+    std::string text;
+    for (uint8_t byte : bytes) {
+        text += modhex_alphabet[byte >> 4];
+        text += modhex_alphabet[byte & 0xf];
+    }
+    return text;
+}
+
+std::vector<KeyboardReport> type_token(uint8_t profile,
+                                       const std::vector<uint8_t> &bytes) {
+    usb_kbd_set_profile(profile);
+    usb_kbd_init();
+    received.clear();
+
+    std::vector<uint8_t> token = bytes;
+    size_t public_id = std::min<size_t>(token.size(), PUBLIC_ID_BYTES);
+    usb_kbd_send_modhex(token.data(), public_id);
+    if (token.size() > public_id) {
+        usb_kbd_send_modhex(&token[public_id], token.size() - public_id);
+    }
+    usb_kbd_send_enter();
+    while (usb_kbd_busy()) {
+        usb_kbd_report_sent();
+    }
+    return received;
+}
+
+std::string decode_reports(const std::vector<KeyboardReport> &reports) {
+    std::string text;
+    KeyboardReport previous = {};
+    for (const KeyboardReport &report : reports) {
+        for (size_t i = 2; i < report.size(); i++) {
+            uint8_t key = report[i];
+            if (key == 0 || std::find(previous.begin() + 2, previous.end(),
+                                      key) != previous.end()) {
+                continue;
+            }
+            if (report[0] != 0) {
+                // modhex never needs a modifier
+                text += '?';
+            } else if (key >= 0x04 && key <= 0x1d) {
+                text += 'a' + key - 0x04;
+            } else if (key == KEY_ENTER) {
+                text += '\n';
+            } else {
+                text += '?';
+            }
+        }
+        previous = report;
+    }
+    return text;
+}
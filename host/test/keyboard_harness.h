@@ -0,0 +1,50 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef HOST_TEST_KEYBOARD_HARNESS_H
+#define HOST_TEST_KEYBOARD_HARNESS_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// runs the app's src/usb_keyboard.c on the host. every report it hands to
+// the USB endpoint is recorded as one transfer, and acknowledged whenever
+// the keyboard waits for one, as the HID class would.
+
+typedef std::array<uint8_t, 8> KeyboardReport;
+
+// a binary token: the public ID, then the encrypted block
+#define PUBLIC_ID_BYTES 6
+#define TOKEN_BYTES 22
+
+// the bytes in modhex, as the app is meant to type them
+std::string modhex(const std::vector<uint8_t> &bytes);
+
+// types the bytes as modhex followed by Enter, with the same calls that
+// type_otp() in src/main.c makes: the public ID first, then the rest. returns
+// the reports the host receives, in order.
+std::vector<KeyboardReport> type_token(uint8_t profile,
+                                       const std::vector<uint8_t> &bytes);
+
+// what a host makes of the reports: a key counts as typed in the report
+// that first has it pressed, and the keys newly pressed in one report are
+// typed in the order they appear in
+std::string decode_reports(const std::vector<KeyboardReport> &reports);
+
+#endif
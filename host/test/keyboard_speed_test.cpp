@@ -0,0 +1,90 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// measures how fast each typing profile gets tokens to a host that polls the
+// keyboard endpoint at the profile's interval. every report takes one
+// transfer, and a transfer takes one polling interval, so a token takes
+// (transfers * interval) ms. the reports also have to decode to the token,
+// as in keyboard_test.cpp.
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+#include "keyboard_harness.h"
+
+extern "C" {
+#include "usb_keyboard.h"
+}
+
+#define RANDOM_TOKENS 2000
+
+// fastest first
+static const uint8_t PROFILES[TYPING_PROFILE_COUNT] = {
+    TYPING_PROFILE_FAST, TYPING_PROFILE_COMPATIBLE, TYPING_PROFILE_SLOW};
+static const char *const PROFILE_NAMES[TYPING_PROFILE_COUNT] = {
+    "fast", "compatible", "slow"};
+
+int main() {
+    // fixed, so that every run measures the same tokens
+    std::mt19937 random(0x79756269);
+    int failures = 0;
+    double previous_rate = 0;
+
+    for (uint32_t i = 0; i < TYPING_PROFILE_COUNT; i++) {
+        uint8_t profile = PROFILES[i];
+        uint64_t transfers = 0;
+        uint32_t fewest = -1U, most = 0;
+        for (uint32_t token = 0; token < RANDOM_TOKENS; token++) {
+            std::vector<uint8_t> bytes(TOKEN_BYTES);
+            for (uint8_t &byte : bytes) {
+                byte = random();
+            }
+            std::vector<KeyboardReport> reports = type_token(profile, bytes);
+            if (decode_reports(reports) !=
+                modhex(bytes) + "\n") {
+                failures++;
+            }
+            transfers += reports.size();
+            fewest = std::min<uint32_t>(fewest, reports.size());
+            most = std::max<uint32_t>(most, reports.size());
+        }
+
+        // type_token() leaves the profile set
+        uint32_t interval = usb_kbd_polling_interval();
+        double per_token = double(transfers) / RANDOM_TOKENS;
+        double rate = 1000 / (per_token * interval);
+        printf("  %-10s %6.1f transfers per token (%u to %u), %2u ms "
+               "interval: %6.2f tokens/s\n",
+               PROFILE_NAMES[i], per_token, fewest, most, interval,
+               rate);
+
+        if (i > 0 && rate >= previous_rate) {
+            fprintf(stderr, "%s isn't slower than %s\n", PROFILE_NAMES[i],
+                    PROFILE_NAMES[i - 1]);
+            failures++;
+        }
+        previous_rate = rate;
+    }
+
+    if (failures) {
+        fprintf(stderr, "keyboard_speed_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("keyboard_speed_test: ok\n");
+    return 0;
+}
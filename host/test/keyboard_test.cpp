@@ -0,0 +1,82 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// types random tokens with every typing profile and replays the reports
+// into a model of the host, which has to end up with exactly the token and
+// a newline, and with no keys held down.
+
+#include <cstdio>
+#include <random>
+
+#include "keyboard_harness.h"
+
+extern "C" {
+#include "usb_keyboard.h"
+}
+
+#define RANDOM_TOKENS 2000
+
+static int failures;
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition);    \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+static void check_token(uint8_t profile, const std::vector<uint8_t> &bytes) {
+    std::vector<KeyboardReport> reports = type_token(profile, bytes);
+    std::string expected = modhex(bytes) + "\n";
+    std::string typed = decode_reports(reports);
+    if (typed != expected) {
+        fprintf(stderr, "profile %u: typed %s, expected %s", profile,
+                typed.c_str(), expected.c_str());
+    }
+    CHECK(typed == expected);
+    CHECK(!reports.empty() && reports.back() == KeyboardReport());
+}
+
+int main() {
+    // fixed, so that every run checks the same tokens
+    std::mt19937 random(0x79756269);
+
+    for (uint8_t profile = 0; profile < TYPING_PROFILE_COUNT; profile++) {
+        // the same key over and over, and two keys taking turns
+        check_token(profile, std::vector<uint8_t>(TOKEN_BYTES, 0x00));
+        check_token(profile, std::vector<uint8_t>(TOKEN_BYTES, 0x01));
+        // all 16 keys in a row, twice
+        check_token(profile, {0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+                              0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef});
+
+        for (uint32_t i = 0; i < RANDOM_TOKENS; i++) {
+            std::vector<uint8_t> bytes(TOKEN_BYTES);
+            for (uint8_t &byte : bytes) {
+                byte = random();
+            }
+            check_token(profile, bytes);
+        }
+    }
+
+    if (failures) {
+        fprintf(stderr, "keyboard_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("keyboard_test: ok\n");
+    return 0;
+}
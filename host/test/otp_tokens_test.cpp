@@ -0,0 +1,132 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// checks the tokens of otp_generate_tokens() the way a validation server
+// would: decrypted with the keyslot's AES key, each has to carry its private
+// ID and boot count, pass the CRC check, and use the next value of the
+// session counter.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <openssl/evp.h>
+
+#include "otp_client.h"
+#include "sim_sdk.h"
+
+extern "C" {
+#include "otp.h"
+}
+
+#define FIRST_COUNTER 10
+#define TOKENS 40
+
+static int failures;
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition);    \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+// the CRC as the Yubico validation server computes it, bit by bit
+static uint16_t yubico_crc(const uint8_t *data, uint32_t length) {
+    uint16_t crc = 0xffff;
+    for (uint32_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int j = 0; j < 8; j++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0x8408 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static bool decrypt(const uint8_t *aes_key, const uint8_t *ciphertext,
+                    uint8_t *plaintext) {
+    EVP_CIPHER_CTX *context = EVP_CIPHER_CTX_new();
+    int length = 0;
+    bool ok = context &&
+              EVP_DecryptInit_ex(context, EVP_aes_128_ecb(), nullptr, aes_key,
+                                 nullptr) == 1 &&
+              EVP_CIPHER_CTX_set_padding(context, 0) == 1 &&
+              EVP_DecryptUpdate(context, plaintext, &length, ciphertext,
+                                OTP_TOKEN_PLAINTEXT_LEN) == 1 &&
+              length == OTP_TOKEN_PLAINTEXT_LEN;
+    EVP_CIPHER_CTX_free(context);
+    return ok;
+}
+
+int main() {
+    uint8_t seed[32];
+    for (uint32_t i = 0; i < sizeof(seed); i++) {
+        seed[i] = i;
+    }
+    otpKeySlot_t key = {{0x01, 0x23, 0x45, 0x67, 0x89, 0xAB}, 0x0102};
+
+    std::lock_guard<std::mutex> lock(sim_otp_mutex);
+    sim_set_seed(seed);
+    otpKeySecrets_t secrets;
+    otp_derive_keys(&key, &secrets);
+
+    token_count_since_boot = FIRST_COUNTER;
+    std::string printable(TOKENS * OTP_TOKEN_LEN + 1, '\0');
+    otp_generate_tokens(&key, TOKENS, &printable[0]);
+    CHECK(printable[TOKENS * OTP_TOKEN_LEN] == '\0');
+    CHECK(token_count_since_boot == FIRST_COUNTER + TOKENS);
+    CHECK(key.boot_count == 0x0102);
+
+    for (uint32_t i = 0; i < TOKENS; i++) {
+        uint8_t token[OTP_TOKEN_RAW_LEN];
+        uint8_t plaintext[OTP_TOKEN_PLAINTEXT_LEN];
+        CHECK(from_modhex(printable.substr(i * OTP_TOKEN_LEN, OTP_TOKEN_LEN),
+                          token, sizeof(token)));
+        CHECK(memcmp(token, key.public_id, OTP_PUBLIC_ID_LEN) == 0);
+        if (!decrypt(secrets.aes_key, &token[OTP_PUBLIC_ID_LEN], plaintext)) {
+            CHECK(!"decrypting the token");
+            continue;
+        }
+
+        CHECK(memcmp(plaintext, secrets.private_id, OTP_PRIVATE_ID_LEN) == 0);
+        CHECK(yubico_crc(plaintext, sizeof(plaintext)) == 0xf0b8);
+        // boot count, little endian
+        CHECK(plaintext[OTP_PRIVATE_ID_LEN] == 0x02 &&
+              plaintext[OTP_PRIVATE_ID_LEN + 1] == 0x01);
+        // timestamp and session counter both follow the token count
+        CHECK(plaintext[OTP_PRIVATE_ID_LEN + 2] == FIRST_COUNTER + i);
+        CHECK(plaintext[OTP_PRIVATE_ID_LEN + 5] == FIRST_COUNTER + i);
+    }
+
+    // a batch that can't be finished isn't started
+    bool thrown = false;
+    try {
+        otp_generate_tokens(&key, 256 - token_count_since_boot, &printable[0]);
+    } catch (const SimThrow &) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(token_count_since_boot == FIRST_COUNTER + TOKENS);
+
+    if (failures) {
+        fprintf(stderr, "otp_tokens_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("otp_tokens_test: ok\n");
+    return 0;
+}
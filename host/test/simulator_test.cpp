@@ -0,0 +1,263 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+// runs the host tool's client against a simulated device through every
+// command, including chained commands and responses fetched with
+// GET_RESPONSE. exits with 1 if anything is off.
+
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "otp_client.h"
+#include "simulated_device.h"
+
+#define INITIAL_KEYS 2
+
+static int failures;
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition);    \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+// sends a single APDU as it is and returns the status word, with the data
+// in data
+static uint16_t exchange(Transport &transport,
+                         const std::vector<uint8_t> &apdu,
+                         std::vector<uint8_t> &data) {
+    std::vector<uint8_t> response = transport.exchange(apdu);
+    if (response.size() < 2) {
+        return 0;
+    }
+    data.assign(response.begin(), response.end() - 2);
+    return (response[response.size() - 2] << 8) | response.back();
+}
+
+template <typename Function>
+static uint16_t error_of(Function function) {
+    try {
+        function();
+    } catch (const ApduError &e) {
+        return e.sw();
+    }
+    return SW_OK;
+}
+
+static void test_otp(OtpClient &client, const Inventory &inventory) {
+    std::string token = client.get_otp(0);
+    CHECK(token.size() == OTP_TOKEN_LEN);
+    CHECK(token.compare(0, 2 * OTP_PUBLIC_ID_LEN,
+                        to_modhex(inventory.keyslots[0].public_id.data(),
+                                  OTP_PUBLIC_ID_LEN)) == 0);
+    CHECK(error_of([&] { client.get_otp(INITIAL_KEYS); }) ==
+          SW_KEYSLOT_NOT_FOUND);
+
+    // the boot count goes up before the first token of the session only,
+    // and only for the keyslot that is used
+    client.get_otp(0);
+    Inventory after = client.export_keyslots();
+    CHECK(after.keyslots[0].boot_count ==
+          inventory.keyslots[0].boot_count + 1);
+    CHECK(after.keyslots[1].boot_count == inventory.keyslots[1].boot_count);
+}
+
+static void test_batch(OtpClient &client, const Inventory &inventory) {
+    // more than fit into one response
+    std::vector<std::vector<uint8_t>> tokens = client.get_otp_batch(1, 30);
+    CHECK(tokens.size() == 30);
+    std::set<std::vector<uint8_t>> distinct;
+    for (const std::vector<uint8_t> &token : tokens) {
+        CHECK(token.size() == OTP_TOKEN_RAW_LEN);
+        CHECK(memcmp(token.data(), inventory.keyslots[1].public_id.data(),
+                     OTP_PUBLIC_ID_LEN) == 0);
+        distinct.insert(token);
+    }
+    CHECK(distinct.size() == tokens.size());
+    CHECK(client.export_keyslots().keyslots[1].boot_count ==
+          inventory.keyslots[1].boot_count + 1);
+}
+
+static std::vector<ImportRecord> make_records(uint32_t count) {
+    std::vector<ImportRecord> records(count);
+    for (uint32_t i = 0; i < count; i++) {
+        records[i].public_id = {0xAA, 0xBB, 0xCC, 0xDD, (uint8_t)(i >> 8),
+                                (uint8_t)i};
+        records[i].boot_count = 100 + i;
+    }
+    return records;
+}
+
+static void test_import(OtpClient &client, uint32_t count) {
+    std::vector<ImportRecord> records = make_records(count);
+    std::vector<PrivateId> private_ids = client.import_keyslots(records);
+    CHECK(private_ids.size() == records.size());
+    CHECK(std::set<PrivateId>(private_ids.begin(), private_ids.end())
+              .size() == records.size());
+
+    // public IDs that are in use already, or twice in the same import
+    CHECK(error_of([&] { client.import_keyslots({records[0]}); }) ==
+          SW_WRONG_DATA);
+    ImportRecord twice = records[0];
+    twice.public_id[0] = 0x11;
+    CHECK(error_of([&] { client.import_keyslots({twice, twice}); }) ==
+          SW_WRONG_DATA);
+    // a boot count that can't go up any further
+    twice.boot_count = 0xFFFF;
+    CHECK(error_of([&] { client.import_keyslots({twice}); }) ==
+          SW_WRONG_DATA);
+}
+
+static void test_export(OtpClient &client, uint32_t imported) {
+    Inventory inventory = client.export_keyslots();
+    CHECK(inventory.keyslots.size() == INITIAL_KEYS + imported);
+    std::vector<ImportRecord> records = make_records(imported);
+    for (uint32_t i = 0; i < imported && i + INITIAL_KEYS <
+                                             inventory.keyslots.size();
+         i++) {
+        const KeyslotRecord &keyslot = inventory.keyslots[INITIAL_KEYS + i];
+        CHECK(keyslot.public_id == records[i].public_id);
+        CHECK(keyslot.boot_count == records[i].boot_count);
+    }
+
+    // an imported boot count may have been used already, so it goes up
+    // before the keyslot's first token, as any other
+    if (imported > 0) {
+        client.get_otp(INITIAL_KEYS);
+        client.get_otp(INITIAL_KEYS);
+        inventory = client.export_keyslots();
+        CHECK(inventory.keyslots[INITIAL_KEYS].boot_count ==
+              records[0].boot_count + 1);
+    }
+}
+
+// a keyslot whose boot count reaches 0xFFFF can be used for the rest of the
+// session, but not after that
+static void test_last_boot_count() {
+    SimulatedDevice device("simulated", 0);
+    OtpClient client(device);
+    ImportRecord record = make_records(1)[0];
+    record.boot_count = 0xFFFE;
+    client.import_keyslots({record});
+
+    client.get_otp(0);
+    CHECK(client.export_keyslots().keyslots[0].boot_count == 0xFFFF);
+    client.get_otp(0);
+    device.restart();
+    CHECK(error_of([&] { client.get_otp(0); }) == SW_DENIED);
+    CHECK(error_of([&] { client.get_otp_batch(0, 1); }) == SW_DENIED);
+    CHECK(client.export_keyslots().keyslots[0].boot_count == 0xFFFF);
+}
+
+static void test_order(OtpClient &client, uint32_t keyslots) {
+    KeyslotOrder order = client.get_keyslot_order();
+    CHECK(order.favourite == KEYSLOT_NONE);
+    CHECK(order.keyslots.size() == keyslots);
+
+    client.move_keyslot(5, 0);
+    client.move_keyslot(0, keyslots - 1);
+    client.set_favourite(3);
+    order = client.get_keyslot_order();
+    CHECK(order.favourite == 3);
+    CHECK(order.keyslots.size() == keyslots);
+    CHECK(order.keyslots.front() == 5);
+    CHECK(order.keyslots.back() == 0);
+    CHECK(std::set<uint8_t>(order.keyslots.begin(), order.keyslots.end())
+              .size() == keyslots);
+
+    CHECK(error_of([&] { client.move_keyslot(0, keyslots); }) ==
+          SW_WRONG_P1P2);
+    CHECK(error_of([&] { client.set_favourite(keyslots); }) ==
+          SW_KEYSLOT_NOT_FOUND);
+    client.set_favourite(KEYSLOT_NONE);
+    CHECK(client.get_keyslot_order().favourite == KEYSLOT_NONE);
+}
+
+// APDUs that the client itself doesn't send
+static void test_raw_apdus(Transport &transport) {
+    std::vector<uint8_t> data;
+
+    // an export starting past the last keyslot ends right away
+    CHECK(exchange(transport, {CLA, INS_EXPORT_KEYSLOTS, EXPORT_END, 0},
+                   data) == SW_OK);
+    CHECK(data.size() == 2 && data[1] == EXPORT_END);
+    CHECK(exchange(transport, {CLA, INS_GET_RESPONSE, 0, 0}, data) ==
+          SW_NO_RESPONSE_DATA);
+
+    // GET_RESPONSE with Le, as an ISO 7816 host sends it
+    uint16_t sw =
+        exchange(transport, {CLA, INS_GET_OTP_BATCH, P1_KEYSLOT_INDEX, 0, 1,
+                             30},
+                 data);
+    CHECK((sw & 0xFF00) == SW_BYTES_REMAINING);
+    sw = exchange(transport, {CLA, INS_GET_RESPONSE, 0, 0, (uint8_t)sw},
+                  data);
+    CHECK(sw == SW_OK || (sw & 0xFF00) == SW_BYTES_REMAINING);
+
+    // a chain interrupted by another command
+    CHECK(exchange(transport,
+                   {CLA | CLA_CHAINING, INS_GET_OTP_BATCH,
+                    P1_KEYSLOT_PUBLIC_ID, 0, 1, 0},
+                   data) == SW_OK);
+    CHECK(exchange(transport, {CLA, INS_EXPORT_KEYSLOTS, 0, 0}, data) ==
+          SW_LAST_COMMAND_EXPECTED);
+
+    // an import with a record split between two APDUs, and one that is
+    // interrupted, neither of which adds any keyslots
+    OtpClient client(transport);
+    size_t keyslots = client.export_keyslots().keyslots.size();
+    CHECK(exchange(transport,
+                   {CLA | CLA_CHAINING, INS_IMPORT_KEYSLOTS, 0, 0, 1, 0},
+                   data) == SW_WRONG_LENGTH);
+    CHECK(exchange(transport,
+                   {CLA | CLA_CHAINING, INS_IMPORT_KEYSLOTS, 0, 0,
+                    IMPORT_RECORD_LEN, 0x7a, 1, 2, 3, 4, 5, 0, 0},
+                   data) == SW_OK);
+    CHECK(exchange(transport, {CLA, INS_GET_KEYSLOT_ORDER, 0, 0}, data) ==
+          SW_LAST_COMMAND_EXPECTED);
+    CHECK(client.export_keyslots().keyslots.size() == keyslots);
+}
+
+int main() {
+    // more than one APDU of data
+    const uint32_t imported = APDU_MAX_DATA / IMPORT_RECORD_LEN + 8;
+
+    SimulatedDevice device("simulated", INITIAL_KEYS);
+    OtpClient client(device);
+    Inventory inventory = client.export_keyslots();
+    CHECK(inventory.keyslots.size() == INITIAL_KEYS);
+
+    test_otp(client, inventory);
+    test_batch(client, inventory);
+    test_import(client, imported);
+    test_export(client, imported);
+    test_order(client, INITIAL_KEYS + imported);
+    test_raw_apdus(device);
+    test_last_boot_count();
+
+    if (failures) {
+        fprintf(stderr, "simulator_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("simulator_test: ok\n");
+    return 0;
+}
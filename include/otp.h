@@ -21,6 +21,9 @@
 
 #include <stdint.h>
 
+#include "os.h"
+#include "cx.h"
+
 #define OTP_DERIVATION_PATH 0x79756269 // 'yubi' in hex
 
 #define OTP_AES_KEY_LEN 16
@@ -32,8 +35,13 @@
 #define OTP_AES_KEY_PRINTABLE_MAX_LEN 12
 #define OTP_TOKEN_LEN 44
 
+// private ID, boot count, timestamp, counter, random bytes and CRC
+#define OTP_TOKEN_PLAINTEXT_LEN (OTP_PRIVATE_ID_LEN + 2 + 3 + 1 + 4)
+// public ID followed by the encrypted plaintext
+#define OTP_TOKEN_RAW_LEN (OTP_PUBLIC_ID_LEN + OTP_TOKEN_PLAINTEXT_LEN)
+
+// 8 bytes with no padding, so that hundreds of them fit into storage
 typedef struct otpKeySlot_t {
-    uint8_t enabled;
     uint8_t public_id[OTP_PUBLIC_ID_LEN];
     uint16_t boot_count;
 } otpKeySlot_t;
@@ -43,12 +51,30 @@ typedef struct otpKeySecrets_t {
     uint8_t private_id[OTP_PRIVATE_ID_LEN];
 } otpKeySecrets_t;
 
+typedef struct otpPendingToken_t {
+    uint8_t plaintext[OTP_TOKEN_PLAINTEXT_LEN];
+} otpPendingToken_t;
+
 void bytes_to_hex(uint8_t* bytes, uint32_t length, char* out);
 
 void bytes_to_modhex(uint8_t* bytes, uint32_t length, char* out);
 
 
-void otp_generate_token(otpKeySlot_t* key, char* token);
+void otp_prepare_token(otpKeySlot_t* key, otpPendingToken_t* pending,
+                       uint8_t* token);
+
+void otp_finalize_token(otpPendingToken_t* pending, otpKeySecrets_t* secrets,
+                        cx_aes_key_t* aes_key, uint8_t* token);
+
+void otp_generate_token_raw(otpKeySlot_t* key, otpKeySecrets_t* secrets,
+                            cx_aes_key_t* aes_key, uint8_t* token);
+
+void otp_generate_token(otpKeySlot_t* key, otpKeySecrets_t* secrets,
+                        cx_aes_key_t* aes_key, char* token);
+
+void otp_generate_tokens(otpKeySlot_t* key, uint32_t n, char* out);
+
+void otp_print_token(uint8_t* token_bytes, char* token);
 
 void otp_print_public_id(otpKeySlot_t* key, char* public_id);
 
@@ -62,4 +88,7 @@ void otp_print_aes_key(otpKeySecrets_t* secrets, char* key1, char* key2, char* k
 
 void otp_reset_token_counter();
 
+uint32_t otp_tokens_left();
+uint32_t otp_tokens_used();
+
 #endif
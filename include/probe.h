@@ -0,0 +1,63 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef PROBE_H
+
+#define PROBE_H
+
+#include <stdint.h>
+
+// counters for measuring performance work on an actual device.
+// BOLOS doesn't give applications access to a cycle counter, so instead of
+// timing the expensive operations we count how often they happen.
+// everything here compiles to nothing unless HAVE_PROBES is defined (see the
+// Makefile). the counters are printed with PRINTF, so HAVE_PRINTF is needed
+// to actually see them.
+
+enum {
+    PROBE_AES_BLOCKS,
+    PROBE_AES_KEY_EXPANSIONS,
+    // flash programming, by far the slowest part of starting the app
+    PROBE_NVM_WRITES,
+    PROBE_NVM_BYTES_WRITTEN,
+    // elements sent to the display over SPI, see probe_tick()
+    PROBE_DISPLAY_PACKETS,
+    PROBE_COUNT,
+};
+
+#ifdef HAVE_PROBES
+
+extern uint32_t probe_counters[PROBE_COUNT];
+
+#define PROBE_INC(probe) (probe_counters[probe]++)
+#define PROBE_ADD(probe, amount) (probe_counters[probe] += (amount))
+
+void probe_reset(void);
+void probe_print(void);
+void probe_tick(void);
+
+#else
+
+#define PROBE_INC(probe)
+#define PROBE_ADD(probe, amount)
+#define probe_reset()
+#define probe_print()
+#define probe_tick()
+
+#endif
+
+#endif
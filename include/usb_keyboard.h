@@ -23,8 +23,34 @@
 
 #define USB_KEYBOARD_H
 
+#include <stdint.h>
+
+// the default comes first, so that the zeroed typing_profile of freshly
+// reset storage selects it
+enum {
+    TYPING_PROFILE_COMPATIBLE,
+    TYPING_PROFILE_FAST,
+    TYPING_PROFILE_SLOW,
+    TYPING_PROFILE_COUNT,
+};
+
+// reports are queued and sent in the background, so the functions below
+// return before the host has received everything
+void usb_kbd_init(void);
 void usb_kbd_send_char(char ch);
 void usb_kbd_send_string(char* s);
+void usb_kbd_send_modhex(uint8_t* bytes, uint32_t length);
 void usb_kbd_send_enter();
+// drops everything that is still queued, then releases all keys
+void usb_kbd_cancel(void);
+// whether reports are still waiting to be sent or in flight
+uint8_t usb_kbd_busy(void);
+
+// the USB device has to be restarted for a new polling interval to apply
+void usb_kbd_set_profile(uint8_t profile);
+uint8_t usb_kbd_polling_interval(void);
+
+// called by the HID class when a keyboard report has been transferred
+void usb_kbd_report_sent(void);
 
 #endif
@@ -30,6 +30,7 @@
 
 #include "usb_keyboard.h"
 #include "otp.h"
+#include "probe.h"
 
 
 #if TARGET_ID != 0x31100002
@@ -39,77 +40,726 @@
 unsigned char G_io_seproxyhal_spi_buffer[IO_SEPROXYHAL_BUFFER_SIZE_B];
 
 #define CLA 0xE0
+// set in CLA on every APDU of a chained command except the last one
+#define CLA_CHAINING 0x10
+
+#define INS_GET_OTP 0x01
+#define INS_GET_OTP_BATCH 0x02
+#define INS_IMPORT_KEYSLOTS 0x03
+#define INS_EXPORT_KEYSLOTS 0x04
+#define INS_GET_KEYSLOT_ORDER 0x05
+#define INS_MOVE_KEYSLOT 0x06
+#define INS_SET_FAVOURITE 0x07
+#define INS_GET_RESPONSE 0xC0
+
+// how the keyslot is selected in GET_OTP
+#define P1_KEYSLOT_INDEX 0x00     // P2 is the index of the keyslot
+#define P1_KEYSLOT_PUBLIC_ID 0x01 // the data is the public ID of the keyslot
+
+#define OFFSET_CLA 0
+#define OFFSET_INS 1
+#define OFFSET_P1 2
+#define OFFSET_P2 3
+#define OFFSET_LC 4
+#define OFFSET_CDATA 5
+
+// flags in the GET_OTP_BATCH response
+#define BATCH_FLAG_TOKENS_LOW 0x01
+// the session counter is considered to be running low below this many tokens
+#define BATCH_TOKENS_LOW_THRESHOLD 32
+
+// a keyslot record in IMPORT_KEYSLOTS: public ID, then big-endian boot count.
+// the same layout as otpKeySlot_t but for the byte order, so that the
+// records can be converted where they are, see handle_import_keyslots()
+#define IMPORT_RECORD_LEN (OTP_PUBLIC_ID_LEN + 2)
+typedef char import_record_is_a_keyslot
+    [sizeof(otpKeySlot_t) == IMPORT_RECORD_LEN ? 1 : -1];
+
+// a keyslot record in EXPORT_KEYSLOTS: keyslot index, public ID, then
+// big-endian boot count
+#define EXPORT_RECORD_LEN (1 + OTP_PUBLIC_ID_LEN + 2)
+// next index in an EXPORT_KEYSLOTS response when there are no more keyslots
+#define EXPORT_END 0xFF
+
+#define SW_OK 0x9000
+// the low byte is how many more bytes GET_RESPONSE will return (0 for 256
+// or more)
+#define SW_BYTES_REMAINING 0x6100
+#define SW_WRONG_LENGTH 0x6700
+#define SW_DENIED 0x6985
+#define SW_LAST_COMMAND_EXPECTED 0x6883
+#define SW_WRONG_DATA 0x6A80
+#define SW_NOT_ENOUGH_KEYSLOTS 0x6A84
+#define SW_TOKENS_EXHAUSTED 0x6986
+#define SW_KEYSLOT_NOT_FOUND 0x6A83
+#define SW_WRONG_P1P2 0x6A86
+#define SW_NO_RESPONSE_DATA 0x6A88
+#define SW_INS_NOT_SUPPORTED 0x6D00
+#define SW_CLA_NOT_SUPPORTED 0x6E00
 
 enum {
     MODE_NONE,
     MODE_CREATE,
     MODE_TYPE,
     MODE_REMOVE,
+    MODE_MOVE,
+    MODE_FAVOURITE,
 };
 uint8_t mode;
 
+// set when what the menus show has changed behind their back, e.g. when
+// keyslots were added over APDU, so that the next ticker event redraws the
+// screen (see display_outdated())
+uint8_t display_dirty;
+
+void display_changed(void) {
+    display_dirty = 1;
+}
+
+// keyslot indices are sent and stored as single bytes, with 0xFF meaning
+// none (see EXPORT_END)
+#if MAX_OTP_KEYSLOTS > 255
+#error "MAX_OTP_KEYSLOTS has to fit into a byte"
+#endif
+#define KEYSLOT_NONE 0xFF
+
+// the keyslots are packed records with no flag of their own: a bit in
+// occupied says whether a keyslot is in use. erase_keyslot() zeroes the
+// record of a keyslot it frees, though a free keyslot can also hold one of
+// an import that was rejected or interrupted.
+// keyslot_order is a permutation of all keyslot indices, see the RAM copy of
+// the same name. favourite is a keyslot index or KEYSLOT_NONE.
 typedef struct internalStorage_t {
-#define STORAGE_MAGIC 0x0420EC41
+// changed along with the layout, so that older storage gets reset
+#define STORAGE_MAGIC 0x0420EC44
     uint32_t magic;
+    uint8_t typing_profile;
+    uint8_t favourite;
+    uint8_t occupied[(MAX_OTP_KEYSLOTS + 7) / 8];
+    uint8_t keyslot_order[MAX_OTP_KEYSLOTS];
     otpKeySlot_t keyslots[MAX_OTP_KEYSLOTS];
 } internalStorage_t;
 
 WIDE internalStorage_t N_storage_real;
 #define N_storage (*(WIDE internalStorage_t *)PIC(&N_storage_real))
 
-void type_otp(otpKeySlot_t* key) {
-    char otp[OTP_TOKEN_LEN + 1];
-    otp_generate_token(key, otp);
-    usb_kbd_send_string(otp);
-    usb_kbd_send_enter();
+// every write to flash goes through here, so that probes can count them
+void storage_write(void WIDE *dst, void WIDE *src, uint32_t length) {
+    PROBE_INC(PROBE_NVM_WRITES);
+    PROBE_ADD(PROBE_NVM_BYTES_WRITTEN, length);
+    nvm_write(dst, src, length);
 }
 
-void reset_keyslots(void) {
-    nvm_write(N_storage.keyslots, NULL, sizeof(N_storage.keyslots));
+uint8_t keyslot_occupied(uint32_t which) {
+    return (N_storage.occupied[which / 8] >> (which % 8)) & 1;
+}
+
+void set_keyslot_occupied(uint32_t which, uint8_t occupied) {
+    uint8_t bits = N_storage.occupied[which / 8];
+    if (occupied) {
+        bits |= 1 << (which % 8);
+    } else {
+        bits &= ~(1 << (which % 8));
+    }
+    storage_write(&N_storage.occupied[which / 8], &bits, sizeof(uint8_t));
+}
+
+// bumped boot counts aren't written over the old ones in N_storage, where
+// the same flash words would take all the wear, but appended to a journal in
+// a region of their own. a keyslot's current boot count is the highest one
+// for its public ID, in N_storage or in the journal. once the journal is
+// full, the current boot counts are written to N_storage (a checkpoint) and
+// the journal starts over.
+// records are matched by public ID rather than by keyslot index, so that
+// they stay valid when keyslots are erased or reused. an empty record has a
+// boot count of 0, which a bumped boot count never is.
+#define BOOT_COUNT_JOURNAL_LEN 128
+
+typedef struct bootCountRecord_t {
+    uint8_t public_id[OTP_PUBLIC_ID_LEN];
+    uint16_t boot_count;
+} bootCountRecord_t;
+
+typedef struct bootCountJournal_t {
+    bootCountRecord_t records[BOOT_COUNT_JOURNAL_LEN];
+} bootCountJournal_t;
+
+WIDE bootCountJournal_t N_journal_real;
+#define N_journal (*(WIDE bootCountJournal_t *)PIC(&N_journal_real))
+
+// where the next record goes
+uint32_t journal_head;
+
+void find_journal_head(void) {
+    journal_head = 0;
+    while (journal_head < BOOT_COUNT_JOURNAL_LEN &&
+           N_journal.records[journal_head].boot_count != 0) {
+        journal_head++;
+    }
 }
 
-void increment_bootcounts(void) {
+// there's no room in RAM for a boot count per keyslot, so this looks through
+// the journal every time. it only holds BOOT_COUNT_JOURNAL_LEN records.
+uint16_t get_boot_count(uint32_t which) {
+    uint16_t boot_count = N_storage.keyslots[which].boot_count;
+    uint32_t record;
+    for (record = 0; record < journal_head; record++) {
+        WIDE bootCountRecord_t *entry = &N_journal.records[record];
+        if (entry->boot_count > boot_count &&
+            os_memcmp(N_storage.keyslots[which].public_id, entry->public_id,
+                      OTP_PUBLIC_ID_LEN) == 0) {
+            boot_count = entry->boot_count;
+        }
+    }
+    return boot_count;
+}
+
+void clear_boot_count_journal(void) {
+    storage_write(&N_journal, NULL, sizeof(N_journal));
+    journal_head = 0;
+}
+
+// only the keyslots that have a newer boot count in the journal are
+// written, at most one per record
+void checkpoint_boot_counts(void) {
     uint32_t i;
     for (i = 0; i < MAX_OTP_KEYSLOTS; i++) {
-        if (N_storage.keyslots[i].enabled) {
-            uint16_t new_boot_count = N_storage.keyslots[i].boot_count + 1;
-            nvm_write(&N_storage.keyslots[i].boot_count,
-                &new_boot_count, sizeof(uint16_t));
+        if (!keyslot_occupied(i)) {
+            continue;
+        }
+        uint16_t boot_count = get_boot_count(i);
+        if (boot_count != N_storage.keyslots[i].boot_count) {
+            storage_write(&N_storage.keyslots[i].boot_count, &boot_count,
+                          sizeof(uint16_t));
         }
     }
+    // the boot counts are safe in N_storage by now, so it doesn't matter if
+    // this doesn't happen
+    clear_boot_count_journal();
 }
 
-void erase_keyslot(uint32_t which) {
-    nvm_write(&N_storage.keyslots[which], NULL, sizeof(N_storage.keyslots[0]));
+void append_boot_count(uint32_t which, uint16_t boot_count) {
+    if (journal_head == BOOT_COUNT_JOURNAL_LEN) {
+        checkpoint_boot_counts();
+    }
+    bootCountRecord_t record;
+    os_memmove(record.public_id, N_storage.keyslots[which].public_id,
+               OTP_PUBLIC_ID_LEN);
+    record.boot_count = boot_count;
+    storage_write(&N_journal.records[journal_head], &record, sizeof(record));
+    journal_head++;
+}
+
+// a copy of the keyslot with its current boot count, for generating tokens.
+// only valid until the next call.
+otpKeySlot_t current_keyslot;
+
+otpKeySlot_t *get_keyslot(uint32_t which) {
+    os_memmove(&current_keyslot, &N_storage.keyslots[which],
+               sizeof(otpKeySlot_t));
+    current_keyslot.boot_count = get_boot_count(which);
+    return &current_keyslot;
+}
+
+// secrets derived for the most recently used keyslots, so that generating a
+// token doesn't go through the whole derivation every time.
+// entries remember the keyslot and the public ID they were derived from, and
+// are only used if it still matches the one in the keyslot.
+// with hundreds of keyslots there's no room for one entry each, so the
+// least recently used entry is evicted, and zeroized.
+#define SECRETS_CACHE_SIZE 4
+
+typedef struct secretsCacheEntry_t {
+    uint8_t valid;
+    uint8_t public_id[OTP_PUBLIC_ID_LEN];
+    uint32_t which;
+    uint32_t last_used;
+    otpKeySecrets_t secrets;
+} secretsCacheEntry_t;
+
+secretsCacheEntry_t secrets_cache[SECRETS_CACHE_SIZE];
+uint32_t secrets_cache_clock;
+
+// AES keys set up for the most recently used keyslots, so that
+// back-to-back tokens from the same keyslot skip cx_aes_init_key().
+// entries are matched and evicted like in secrets_cache.
+#define AES_KEY_CACHE_SIZE 2
+
+typedef struct aesKeyCacheEntry_t {
+    uint8_t valid;
+    uint8_t public_id[OTP_PUBLIC_ID_LEN];
+    uint32_t which;
+    uint32_t last_used;
+    cx_aes_key_t aes_key;
+} aesKeyCacheEntry_t;
+
+aesKeyCacheEntry_t aes_key_cache[AES_KEY_CACHE_SIZE];
+uint32_t aes_key_cache_clock;
+
+void clear_key_caches(void) {
+    os_memset(secrets_cache, 0, sizeof(secrets_cache));
+    os_memset(aes_key_cache, 0, sizeof(aes_key_cache));
+    secrets_cache_clock = 0;
+    aes_key_cache_clock = 0;
+}
 
+// drops whatever is cached for one keyslot
+void forget_keyslot_keys(uint32_t which) {
     uint32_t i;
-    uint32_t overwrite = which;
-    for (i = which + 1; i < MAX_OTP_KEYSLOTS; i++) {
-        if (N_storage.keyslots[i].enabled) {
-            nvm_write(&N_storage.keyslots[overwrite],
-                &N_storage.keyslots[i],
-                sizeof(N_storage.keyslots[0]));
-            overwrite++;
-            nvm_write(&N_storage.keyslots[i], NULL, sizeof(N_storage.keyslots[0]));
+    for (i = 0; i < SECRETS_CACHE_SIZE; i++) {
+        if (secrets_cache[i].which == which) {
+            os_memset(&secrets_cache[i], 0, sizeof(secretsCacheEntry_t));
+        }
+    }
+    for (i = 0; i < AES_KEY_CACHE_SIZE; i++) {
+        if (aes_key_cache[i].which == which) {
+            os_memset(&aes_key_cache[i], 0, sizeof(aesKeyCacheEntry_t));
         }
     }
 }
 
-uint32_t find_free_keyslot(void) {
+otpKeySecrets_t *get_keyslot_secrets(uint32_t which) {
+    otpKeySlot_t *key = &N_storage.keyslots[which];
+    secretsCacheEntry_t *entry = NULL;
+    uint32_t i;
+
+    secrets_cache_clock++;
+    for (i = 0; i < SECRETS_CACHE_SIZE; i++) {
+        secretsCacheEntry_t *candidate = &secrets_cache[i];
+        if (candidate->valid && candidate->which == which &&
+            os_memcmp(candidate->public_id, key->public_id,
+                      OTP_PUBLIC_ID_LEN) == 0) {
+            candidate->last_used = secrets_cache_clock;
+            return &candidate->secrets;
+        }
+        if (entry == NULL ||
+            (entry->valid &&
+             (!candidate->valid || candidate->last_used < entry->last_used))) {
+            entry = candidate;
+        }
+    }
+
+    os_memset(entry, 0, sizeof(secretsCacheEntry_t));
+    otp_derive_keys(key, &entry->secrets);
+    os_memmove(entry->public_id, key->public_id, OTP_PUBLIC_ID_LEN);
+    entry->which = which;
+    entry->last_used = secrets_cache_clock;
+    entry->valid = 1;
+    return &entry->secrets;
+}
+
+cx_aes_key_t *get_keyslot_aes_key(uint32_t which) {
+    otpKeySlot_t *key = &N_storage.keyslots[which];
+    aesKeyCacheEntry_t *entry = NULL;
+    uint32_t i;
+
+    aes_key_cache_clock++;
+    for (i = 0; i < AES_KEY_CACHE_SIZE; i++) {
+        aesKeyCacheEntry_t *candidate = &aes_key_cache[i];
+        if (candidate->valid && candidate->which == which &&
+            os_memcmp(candidate->public_id, key->public_id,
+                      OTP_PUBLIC_ID_LEN) == 0) {
+            candidate->last_used = aes_key_cache_clock;
+            return &candidate->aes_key;
+        }
+        // evict an empty entry if there is one, the least recently used
+        // one otherwise
+        if (entry == NULL ||
+            (entry->valid &&
+             (!candidate->valid || candidate->last_used < entry->last_used))) {
+            entry = candidate;
+        }
+    }
+
+    os_memset(entry, 0, sizeof(aesKeyCacheEntry_t));
+    PROBE_INC(PROBE_AES_KEY_EXPANSIONS);
+    cx_aes_init_key(get_keyslot_secrets(which)->aes_key, OTP_AES_KEY_LEN,
+                    &entry->aes_key);
+    os_memmove(entry->public_id, key->public_id, OTP_PUBLIC_ID_LEN);
+    entry->which = which;
+    entry->last_used = aes_key_cache_clock;
+    entry->valid = 1;
+    return &entry->aes_key;
+}
+
+// the keyslot whose secrets and AES key are being derived ahead of time
+// while the UI is idle, so that selecting it only has to encrypt a block.
+// a token itself is never generated ahead of time: that would use up a value
+// of the session counter for every keyslot scrolled past.
+// it takes one step per ticker event, see precompute_keys().
+uint32_t precompute_slot;
+
+// how far precompute_keys() has got for precompute_slot
+enum {
+    PRECOMPUTE_SECRETS,
+    PRECOMPUTE_AES_KEY,
+    PRECOMPUTE_DONE,
+};
+uint8_t precompute_step;
+
+void restart_precompute(void) {
+    precompute_step = PRECOMPUTE_SECRETS;
+}
+
+// keyslots whose boot count has already gone up this session, one bit each.
+// a keyslot's boot count is only bumped right before its first token of the
+// session, so sessions that don't use a keyslot leave it (and the flash)
+// alone.
+uint8_t bumped_keyslots[(MAX_OTP_KEYSLOTS + 7) / 8];
+
+void clear_bumped_keyslots(void) {
+    os_memset(bumped_keyslots, 0, sizeof(bumped_keyslots));
+}
+
+uint8_t keyslot_bumped(uint32_t which) {
+    return (bumped_keyslots[which / 8] >> (which % 8)) & 1;
+}
+
+void set_keyslot_bumped(uint32_t which, uint8_t bumped) {
+    if (bumped) {
+        bumped_keyslots[which / 8] |= 1 << (which % 8);
+    } else {
+        bumped_keyslots[which / 8] &= ~(1 << (which % 8));
+    }
+}
+
+// has to be called before generating a token
+void bump_bootcount(uint32_t which) {
+    if (keyslot_bumped(which)) {
+        return;
+    }
+    uint16_t boot_count = get_boot_count(which);
+    if (boot_count == 0xFFFF) {
+        // wrapping around would make the tokens look old
+        THROW(EXCEPTION);
+    }
+    append_boot_count(which, boot_count + 1);
+    set_keyslot_bumped(which, 1);
+}
+
+// whether a token can be generated for the keyslot, i.e. neither
+// bump_bootcount() nor otp_prepare_token() is going to throw
+uint8_t token_available(uint32_t which) {
+    return otp_tokens_left() > 0 &&
+           (keyslot_bumped(which) || get_boot_count(which) != 0xFFFF);
+}
+
+void generate_otp(uint32_t which, uint8_t *otp) {
+    bump_bootcount(which);
+    otp_generate_token_raw(get_keyslot(which), get_keyslot_secrets(which),
+                           get_keyslot_aes_key(which), otp);
+}
+
+void type_otp(uint32_t which) {
+    uint8_t otp[OTP_TOKEN_RAW_LEN];
+    // the public ID doesn't depend on the boot count or the secrets, so all
+    // of it is queued before the boot count is written and the secrets are
+    // derived (unless precompute_keys() got to them first). whatever would
+    // stop the token is checked before that, so that it is never cut off
+    // after the public ID.
+    otpPendingToken_t pending;
+    if (!token_available(which)) {
+        THROW(EXCEPTION);
+    }
+    usb_kbd_send_modhex(get_keyslot(which)->public_id, OTP_PUBLIC_ID_LEN);
+    bump_bootcount(which);
+    otp_prepare_token(get_keyslot(which), &pending, otp);
+    otpKeySecrets_t *secrets = get_keyslot_secrets(which);
+    cx_aes_key_t *aes_key = get_keyslot_aes_key(which);
+    otp_finalize_token(&pending, secrets, aes_key, otp);
+    usb_kbd_send_modhex(&otp[OTP_PUBLIC_ID_LEN],
+                        OTP_TOKEN_RAW_LEN - OTP_PUBLIC_ID_LEN);
+    probe_print();
+    usb_kbd_send_enter();
+}
+
+// what the rest of a response that didn't fit into one APDU is made of.
+// the rest is only generated when the host asks for it with GET_RESPONSE, and
+// is dropped as soon as any other APDU arrives.
+#define RESPONSE_NONE 0
+#define RESPONSE_EXPORT 1    // keyslot records, starting from keyslot next
+#define RESPONSE_OTP_BATCH 2 // remaining tokens for apdu_keyslot
+#define RESPONSE_IMPORT 3    // private IDs, starting from import_new[next]
+
+typedef struct responseContinuation_t {
+    uint8_t kind;
+    uint32_t next;
+    uint32_t remaining;
+} responseContinuation_t;
+
+responseContinuation_t response_continuation;
+
+void clear_response_continuation(void) {
+    os_memset(&response_continuation, 0, sizeof(response_continuation));
+}
+
+// the order the menus list keyslots in, a RAM copy of
+// N_storage.keyslot_order: the first keyslot_order_count entries are the
+// keyslots in use, in the order they are shown, and the rest are the free
+// ones. new keyslots are taken from just after the ones in use, so they
+// show up at the end of the list, and erased ones are moved there first.
+// reordering never moves keyslot records, it only rewrites part of this.
+uint8_t keyslot_order[MAX_OTP_KEYSLOTS];
+uint32_t keyslot_order_count;
+
+void store_keyslot_order(uint32_t first, uint32_t end) {
+    storage_write(&N_storage.keyslot_order[first], &keyslot_order[first],
+                  end - first);
+}
+
+// reads the order back from N_storage. keyslots in use that ended up
+// behind free ones are moved up, which can only happen if the app was
+// interrupted halfway through a change.
+void load_keyslot_order(void) {
+    uint32_t pass;
+    uint32_t i;
+    uint32_t position = 0;
+    // the keyslots in use on the first pass, the free ones on the second
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < MAX_OTP_KEYSLOTS; i++) {
+            uint8_t which = N_storage.keyslot_order[i];
+            if (keyslot_occupied(which) == (pass == 0)) {
+                keyslot_order[position++] = which;
+            }
+        }
+    }
+    if (os_memcmp(keyslot_order, N_storage.keyslot_order,
+                  MAX_OTP_KEYSLOTS) != 0) {
+        store_keyslot_order(0, MAX_OTP_KEYSLOTS);
+    }
+}
+
+// where keyslot which is in keyslot_order
+uint32_t keyslot_position(uint32_t which) {
+    uint32_t position;
+    for (position = 0; position < MAX_OTP_KEYSLOTS; position++) {
+        if (keyslot_order[position] == which) {
+            break;
+        }
+    }
+    return position;
+}
+
+// moves the keyslot at position from to position to, shifting the ones in
+// between by one. only the entries in that range are written.
+void move_in_keyslot_order(uint32_t from, uint32_t to) {
+    uint8_t which = keyslot_order[from];
+    display_changed();
+    if (from < to) {
+        os_memmove(&keyslot_order[from], &keyslot_order[from + 1], to - from);
+        keyslot_order[to] = which;
+        store_keyslot_order(from, to + 1);
+    } else if (from > to) {
+        os_memmove(&keyslot_order[to + 1], &keyslot_order[to], from - to);
+        keyslot_order[to] = which;
+        store_keyslot_order(to, from + 1);
+    }
+}
+
+// keyslot_order_count is the number of keyslots in use, which are always
+// the first ones in keyslot_order
+void count_keyslots(void) {
+    keyslot_order_count = 0;
+    while (keyslot_order_count < MAX_OTP_KEYSLOTS &&
+           keyslot_occupied(keyslot_order[keyslot_order_count])) {
+        keyslot_order_count++;
+    }
+}
+
+// public ID of the favourite keyslot for the main menu
+char favourite_description[OTP_PUBLIC_ID_PRINTABLE_LEN + 1];
+
+// the favourite keyslot, or KEYSLOT_NONE if there is none
+uint32_t favourite_keyslot(void) {
+    uint32_t which = N_storage.favourite;
+    if (which >= MAX_OTP_KEYSLOTS || !keyslot_occupied(which)) {
+        return KEYSLOT_NONE;
+    }
+    return which;
+}
+
+void update_favourite_description(void) {
+    uint32_t which = favourite_keyslot();
+    if (which == KEYSLOT_NONE) {
+        strcpy(favourite_description, "not set");
+    } else {
+        bytes_to_modhex(N_storage.keyslots[which].public_id,
+                        OTP_PUBLIC_ID_LEN, favourite_description);
+    }
+}
+
+void set_favourite(uint8_t which) {
+    storage_write(&N_storage.favourite, &which, sizeof(uint8_t));
+    update_favourite_description();
+    display_changed();
+}
+
+// the keyslots in keyslot_order again, sorted by public ID, so that
+// find_keyslot_by_public_id() can do a binary search instead of comparing
+// against every keyslot
+uint8_t public_id_index[MAX_OTP_KEYSLOTS];
+
+// binary search in the first count entries of public_id_index: returns the
+// position of the first one whose public ID isn't less than public_id, or
+// count if there is none
+uint32_t public_id_index_lower_bound(uint8_t *public_id, uint32_t count) {
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        if (os_memcmp(N_storage.keyslots[public_id_index[middle]].public_id,
+                      public_id, OTP_PUBLIC_ID_LEN) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// printable public IDs for the keyslot lists. one for every keyslot would
+// take more RAM than there is, so this only holds a window of positions
+// around the highlighted entry: the keyslot at position p in keyslot_order
+// goes into entry p % PUBLIC_ID_CACHE_SIZE, tagged with its index.
+#define PUBLIC_ID_CACHE_SIZE 8
+
+typedef struct publicIdCacheEntry_t {
+    uint8_t which; // KEYSLOT_NONE if the entry is empty
+    char text[OTP_PUBLIC_ID_PRINTABLE_LEN + 1];
+} publicIdCacheEntry_t;
+
+publicIdCacheEntry_t public_id_cache[PUBLIC_ID_CACHE_SIZE];
+
+void clear_public_id_cache(void) {
+    uint32_t i;
+    for (i = 0; i < PUBLIC_ID_CACHE_SIZE; i++) {
+        public_id_cache[i].which = KEYSLOT_NONE;
+    }
+}
+
+// the printable public ID of the keyslot at position in keyslot_order. it
+// stays valid until a position PUBLIC_ID_CACHE_SIZE away is looked up.
+const char *printable_public_id(uint32_t position) {
+    uint8_t which = keyslot_order[position];
+    publicIdCacheEntry_t *entry =
+        &public_id_cache[position % PUBLIC_ID_CACHE_SIZE];
+    if (entry->which != which) {
+        otp_print_public_id(&N_storage.keyslots[which], entry->text);
+        entry->which = which;
+    }
+    return entry->text;
+}
+
+// fills the cache for the positions around center, so that moving a few
+// entries up or down the list finds them ready
+void fill_public_id_cache(uint32_t center) {
+    uint32_t position = center > PUBLIC_ID_CACHE_SIZE / 2 - 1
+                            ? center - (PUBLIC_ID_CACHE_SIZE / 2 - 1)
+                            : 0;
+    uint32_t end = position + PUBLIC_ID_CACHE_SIZE;
+    for (; position < end && position < keyslot_order_count; position++) {
+        printable_public_id(position);
+    }
+}
+
+// has to be called after count_keyslots()
+void rebuild_public_id_index(void) {
+    uint32_t i;
+    for (i = 0; i < keyslot_order_count; i++) {
+        uint8_t which = keyslot_order[i];
+        uint32_t position = public_id_index_lower_bound(
+            N_storage.keyslots[which].public_id, i);
+        os_memmove(&public_id_index[position + 1], &public_id_index[position],
+                   i - position);
+        public_id_index[position] = which;
+    }
+}
+
+// an IMPORT_KEYSLOTS in progress: its records go into the free keyslots at
+// positions import_first to import_first + import_count - 1 of keyslot_order
+// as they arrive, see handle_import_keyslots(). adding or removing a keyslot
+// in the meantime could hand one of them out, so it interrupts the import.
+uint32_t import_first;
+uint32_t import_count;
+uint8_t import_interrupted;
+
+// updates everything kept in RAM about the keyslot table, after keyslots have
+// been added or removed
+void keyslots_changed(void) {
+    import_interrupted = 1;
+    count_keyslots();
+    rebuild_public_id_index();
+    clear_public_id_cache();
+    display_changed();
+    update_favourite_description();
+}
+
+void reset_keyslots(void) {
     uint32_t i;
+    storage_write(N_storage.occupied, NULL, sizeof(N_storage.occupied));
+    storage_write(N_storage.keyslots, NULL, sizeof(N_storage.keyslots));
     for (i = 0; i < MAX_OTP_KEYSLOTS; i++) {
-        if (!N_storage.keyslots[i].enabled)
-            return i;
+        keyslot_order[i] = i;
+    }
+    store_keyslot_order(0, MAX_OTP_KEYSLOTS);
+    set_favourite(KEYSLOT_NONE);
+    clear_boot_count_journal();
+    clear_key_caches();
+    restart_precompute();
+    clear_response_continuation();
+    clear_bumped_keyslots();
+    keyslots_changed();
+}
+
+// marks the keyslot as free, after moving it behind the other keyslots in
+// use in keyslot_order, then zeroes its record so that the public ID and
+// boot count don't stay behind in flash. the bit goes first: a keyslot that
+// is still in use never has a zeroed record, even if this is interrupted.
+void erase_keyslot(uint32_t which) {
+    forget_keyslot_keys(which);
+    restart_precompute();
+    clear_response_continuation();
+    if (N_storage.favourite == which) {
+        set_favourite(KEYSLOT_NONE);
+    }
+    move_in_keyslot_order(keyslot_position(which), keyslot_order_count - 1);
+    set_keyslot_occupied(which, 0);
+    storage_write(&N_storage.keyslots[which], NULL, sizeof(otpKeySlot_t));
+    set_keyslot_bumped(which, 0);
+    keyslots_changed();
+}
+
+// the next keyslot in keyslot_order that isn't in use, or -1U
+uint32_t find_free_keyslot(void) {
+    if (keyslot_order_count == MAX_OTP_KEYSLOTS) {
+        return -1U;
+    }
+    return keyslot_order[keyslot_order_count];
+}
+
+uint32_t find_keyslot_by_public_id(uint8_t *public_id) {
+    uint32_t position =
+        public_id_index_lower_bound(public_id, keyslot_order_count);
+    if (position < keyslot_order_count &&
+        os_memcmp(N_storage.keyslots[public_id_index[position]].public_id,
+                  public_id, OTP_PUBLIC_ID_LEN) == 0) {
+        return public_id_index[position];
     }
-    return -1UL;
+    return -1U;
 }
 
 uint8_t add_keyslot(otpKeySlot_t* keyslot) {
     uint32_t where = find_free_keyslot();
-    if (where == -1UL) {
+    if (where == -1U) {
         return 0;
     }
-    nvm_write(&N_storage.keyslots[where], keyslot, sizeof(otpKeySlot_t));
+    storage_write(&N_storage.keyslots[where], keyslot, sizeof(otpKeySlot_t));
+    set_keyslot_occupied(where, 1);
+    // a new key hasn't generated any tokens yet, so its first boot count is
+    // still unused. imported keys are bumped as usual, since they may come
+    // with a boot count that has already been used.
+    set_keyslot_bumped(where, 1);
+    keyslots_changed();
     return 1;
 }
 
@@ -120,22 +770,22 @@ void menu_list_init(unsigned int new_mode);
 const ux_menu_entry_t menu_about[] = {
     {NULL, NULL, 0, NULL, "Yubico OTP", "for Nano S", 0, 0},
     {NULL, NULL, 0, NULL, "Version", APPVERSION, 0, 0},
-    {menu_main, NULL, 4, &C_icon_back, "Back", NULL, 61, 40},
+    {menu_main, NULL, 7, &C_icon_back, "Back", NULL, 61, 40},
     UX_MENU_END};
 
 void menu_reset_confirm(unsigned int ignored) {
     UNUSED(ignored);
     reset_keyslots();
-    UX_MENU_DISPLAY(3, menu_main, NULL);
+    UX_MENU_DISPLAY(5, menu_main, NULL);
 }
 
 const ux_menu_entry_t menu_reset_all[] = {
-    {menu_main, NULL, 3, NULL, "No", NULL, 0, 0},
+    {menu_main, NULL, 5, NULL, "No", NULL, 0, 0},
     {NULL, menu_reset_confirm, 0, NULL, "Yes", NULL, 0, 0},
     UX_MENU_END};
 
 void menu_entry_type_otp(unsigned int which) {
-    type_otp(&N_storage.keyslots[which]);
+    type_otp(which);
 }
 
 uint32_t removed_entry;
@@ -162,14 +812,49 @@ void menu_entry_remove(unsigned int which) {
     UX_MENU_DISPLAY(0, menu_entry_reset, NULL);
 }
 
-char public_id[OTP_PUBLIC_ID_PRINTABLE_LEN + 1];
-char public_id_prev[OTP_PUBLIC_ID_PRINTABLE_LEN + 1];
-char public_id_next[OTP_PUBLIC_ID_PRINTABLE_LEN + 1];
+void menu_entry_move(unsigned int which) {
+    move_in_keyslot_order(keyslot_position(which), 0);
+    // redisplay the complete move menu, with the keyslot on top
+    menu_list_init(MODE_MOVE);
+}
+
+void menu_entry_favourite(unsigned int which) {
+    set_favourite(which);
+    UX_MENU_DISPLAY(0, menu_main, NULL);
+}
+
+void menu_clear_favourite(unsigned int ignored) {
+    UNUSED(ignored);
+    set_favourite(KEYSLOT_NONE);
+    UX_MENU_DISPLAY(0, menu_main, NULL);
+}
+
+const ux_menu_entry_t menu_arrange[] = {
+    {NULL, menu_list_init, MODE_MOVE, NULL, "Move to top", NULL, 0, 0},
+    {NULL, menu_list_init, MODE_FAVOURITE, NULL, "Set favourite", NULL, 0,
+     0},
+    {NULL, menu_clear_favourite, 0, NULL, "No favourite", NULL, 0, 0},
+    {menu_main, NULL, 3, &C_icon_back, "Back", NULL, 61, 40},
+    UX_MENU_END};
+
+// types a token from the favourite keyslot, or lets the user pick one if
+// there is none yet
+void menu_favourite(unsigned int ignored) {
+    UNUSED(ignored);
+    uint32_t which = favourite_keyslot();
+    if (which == KEYSLOT_NONE) {
+        menu_list_init(MODE_FAVOURITE);
+        return;
+    }
+    type_otp(which);
+}
+
+// the public IDs are filled in from public_id_cache
 const ux_menu_entry_t menu_entries_default[] = {
-    {NULL, NULL, 0, NULL, public_id_prev, NULL, 0, 0},
-    {NULL, menu_entry_type_otp, 0, NULL, public_id, NULL, 0, 0},
-    {NULL, NULL, 0, NULL, public_id_next, NULL, 0, 0},
-    {menu_main, NULL, 2, &C_icon_back, "Back", NULL, 61, 40},
+    {NULL, NULL, 0, NULL, NULL, NULL, 0, 0},
+    {NULL, menu_entry_type_otp, 0, NULL, NULL, NULL, 0, 0},
+    {NULL, NULL, 0, NULL, NULL, NULL, 0, 0},
+    {menu_main, NULL, 4, &C_icon_back, "Back", NULL, 61, 40},
 };
 ux_menu_entry_t fake_entries[4];
 
@@ -181,10 +866,18 @@ const ux_menu_entry_t *menu_entries_iterator(unsigned int entry_index) {
         // return to appropriate entry of main menu
         switch (mode) {
         case MODE_TYPE:
-            fake_entries[3].userid = 0;
+            fake_entries[3].userid = 1;
             break;
         case MODE_REMOVE:
-            fake_entries[3].userid = 2;
+            fake_entries[3].userid = 4;
+            break;
+        case MODE_MOVE:
+            fake_entries[3].menu = menu_arrange;
+            fake_entries[3].userid = 0;
+            break;
+        case MODE_FAVOURITE:
+            fake_entries[3].menu = menu_arrange;
+            fake_entries[3].userid = 1;
             break;
         }
         return &fake_entries[3];
@@ -195,13 +888,13 @@ const ux_menu_entry_t *menu_entries_iterator(unsigned int entry_index) {
         // not called if no previous element
         os_memmove(&fake_entries[0], &menu_entries_default[0],
                    sizeof(ux_menu_entry_t));
-        otp_print_public_id(&N_storage.keyslots[entry_index], public_id_prev);
+        fake_entries[0].line1 = printable_public_id(entry_index);
         return &fake_entries[0];
     } else if (ux_menu.current_entry == entry_index) {
         // get current
         os_memmove(&fake_entries[1], &menu_entries_default[1],
                    sizeof(ux_menu_entry_t));
-        otp_print_public_id(&N_storage.keyslots[entry_index], public_id);
+        fake_entries[1].line1 = printable_public_id(entry_index);
         switch (mode) {
         case MODE_TYPE:
             fake_entries[1].callback = &menu_entry_type_otp;
@@ -209,38 +902,78 @@ const ux_menu_entry_t *menu_entries_iterator(unsigned int entry_index) {
         case MODE_REMOVE:
             fake_entries[1].callback = &menu_entry_remove;
             break;
+        case MODE_MOVE:
+            fake_entries[1].callback = &menu_entry_move;
+            break;
+        case MODE_FAVOURITE:
+            fake_entries[1].callback = &menu_entry_favourite;
+            break;
         }
-        fake_entries[1].userid = entry_index;
+        fake_entries[1].userid = keyslot_order[entry_index];
         return &fake_entries[1];
     } else { // ux_menu.current_entry < entry_index
         // get next
         // not called if no next element
         os_memmove(&fake_entries[2], &menu_entries_default[2],
                    sizeof(ux_menu_entry_t));
-        otp_print_public_id(&N_storage.keyslots[entry_index], public_id_next);
+        fake_entries[2].line1 = printable_public_id(entry_index);
         return &fake_entries[2];
     }
 }
 
 void menu_list_init(unsigned int new_mode) {
+    fill_public_id_cache(0);
     UX_MENU_DISPLAY(0, NULL, NULL);
-    // count number of entries
-    ux_menu.menu_entries_count = 0;
-    uint32_t i;
-    for (i = 0; i < MAX_OTP_KEYSLOTS; i++) {
-        if (N_storage.keyslots[i].enabled)
-            ux_menu.menu_entries_count++;
-    }
-    // the back item
-    ux_menu.menu_entries_count++;
+    // the keyslots, then the back item
+    ux_menu.menu_entries_count = keyslot_order_count + 1;
     // setup iterator
     ux_menu.menu_iterator = menu_entries_iterator;
     mode = new_mode;
 }
 
+// called on idle ticker events: gets the secrets and AES key of the keyslot
+// highlighted in the "OTP keys" list, or of the favourite when it is
+// highlighted in the main menu, into the key caches over the next few calls.
+// neither depends on the session counter, so scrolling through the keyslots
+// doesn't use up any tokens.
+void precompute_keys(void) {
+    uint32_t which;
+    if (ux_menu.menu_entries == menu_main && ux_menu.current_entry == 0 &&
+        favourite_keyslot() != KEYSLOT_NONE) {
+        which = favourite_keyslot();
+    } else if (mode == MODE_TYPE &&
+               ux_menu.menu_iterator == menu_entries_iterator &&
+               ux_menu.current_entry < ux_menu.menu_entries_count - 1) {
+        which = keyslot_order[ux_menu.current_entry];
+    } else {
+        // not looking at a keyslot
+        restart_precompute();
+        return;
+    }
+
+    if (precompute_step != PRECOMPUTE_SECRETS && precompute_slot != which) {
+        restart_precompute();
+    }
+
+    // a single step, so that no ticker event is held up by more than one
+    // derivation
+    switch (precompute_step) {
+    case PRECOMPUTE_SECRETS:
+        get_keyslot_secrets(which);
+        break;
+    case PRECOMPUTE_AES_KEY:
+        get_keyslot_aes_key(which);
+        break;
+    default:
+        return;
+    }
+    precompute_slot = which;
+    precompute_step++;
+}
+
 const ux_menu_entry_t menu_out_of_keyslots[] = {
     {NULL, NULL, 0, NULL, "Error", "Too many keys", 0, 0},
-    {menu_main, NULL, 0, &C_icon_back, "Back", NULL, 61, 40},
+    {menu_main, NULL, 2, &C_icon_back, "Back", NULL, 61, 40},
     UX_MENU_END};
 
 char new_key_public_id[OTP_PUBLIC_ID_PRINTABLE_LEN + 1];
@@ -254,13 +987,13 @@ const ux_menu_entry_t menu_new_key[] = {
     {NULL, NULL, 0, NULL, "AES key (1/3)", new_key_aes_1, 0, 0},
     {NULL, NULL, 0, NULL, "AES key (2/3)", new_key_aes_2, 0, 0},
     {NULL, NULL, 0, NULL, "AES key (3/3)", new_key_aes_3, 0, 0},
-    {menu_main, NULL, 0, &C_icon_back, "Done", NULL, 61, 40},
+    {menu_main, NULL, 2, &C_icon_back, "Done", NULL, 61, 40},
     UX_MENU_END};
 
 void menu_new_entry(unsigned int userid) {
     UNUSED(userid);
 
-    if (find_free_keyslot() == -1UL) {
+    if (find_free_keyslot() == -1U) {
         UX_MENU_DISPLAY(0, menu_out_of_keyslots, NULL);
         return;
     }
@@ -280,15 +1013,649 @@ void menu_new_entry(unsigned int userid) {
     UX_MENU_DISPLAY(0, menu_new_key, NULL);
 }
 
+// set when the typing profile was changed while a token was still being
+// typed. the reconnect waits for the keyboard to finish, see the ticker
+// event in io_event().
+uint8_t usb_restart_pending;
+
+// switches to the stored typing profile and reconnects, so that the host
+// picks up the new polling interval
+void restart_usb(void) {
+    usb_restart_pending = 0;
+    usb_kbd_set_profile(N_storage.typing_profile);
+    usb_kbd_init();
+    USB_power(0);
+    USB_power(1);
+}
+
+void menu_typing_profile_select(unsigned int profile) {
+    uint8_t new_profile = profile;
+    storage_write(&N_storage.typing_profile, &new_profile, sizeof(uint8_t));
+    // reconnecting now would cut off the rest of a token
+    if (usb_kbd_busy()) {
+        usb_restart_pending = 1;
+    } else {
+        restart_usb();
+    }
+    UX_MENU_DISPLAY(6, menu_main, NULL);
+}
+
+// in the order of the TYPING_PROFILE_* values, which are also the entries'
+// positions
+const ux_menu_entry_t menu_typing_profile[] = {
+    {NULL, menu_typing_profile_select, TYPING_PROFILE_COMPATIBLE, NULL,
+     "Compatible", NULL, 0, 0},
+    {NULL, menu_typing_profile_select, TYPING_PROFILE_FAST, NULL, "Fast", NULL,
+     0, 0},
+    {NULL, menu_typing_profile_select, TYPING_PROFILE_SLOW, NULL, "Slow", NULL,
+     0, 0},
+    {menu_main, NULL, 6, &C_icon_back, "Back", NULL, 61, 40},
+    UX_MENU_END};
+
+void menu_typing_profile_init(unsigned int ignored) {
+    UNUSED(ignored);
+    // start on the profile that is currently in use
+    UX_MENU_DISPLAY(N_storage.typing_profile < TYPING_PROFILE_COUNT
+                        ? N_storage.typing_profile
+                        : TYPING_PROFILE_COMPATIBLE,
+                    menu_typing_profile, NULL);
+}
+
+void menu_quit(unsigned int code) {
+    usb_kbd_cancel();
+    clear_key_caches();
+    os_sched_exit(code);
+}
+
 const ux_menu_entry_t menu_main[] = {
-    {NULL, menu_list_init, MODE_CREATE, NULL, "OTP keys", NULL, 0, 0},
+    {NULL, menu_favourite, 0, NULL, "Favourite", favourite_description, 0, 0},
+    {NULL, menu_list_init, MODE_TYPE, NULL, "OTP keys", NULL, 0, 0},
     {NULL, menu_new_entry, 0, NULL, "New random key", NULL, 0, 0},
+    {menu_arrange, NULL, 0, NULL, "Arrange keys", NULL, 0, 0},
     {NULL, menu_list_init, MODE_REMOVE, NULL, "Delete key", NULL, 0, 0},
     {menu_reset_all, NULL, 0, NULL, "Delete all", NULL, 0, 0},
+    {NULL, menu_typing_profile_init, 0, NULL, "Typing speed", NULL, 0, 0},
     {menu_about, NULL, 0, NULL, "About", NULL, 0, 0},
-    {NULL, os_sched_exit, 0, &C_icon_dashboard, "Quit app", NULL, 50, 29},
+    {NULL, menu_quit, 0, &C_icon_dashboard, "Quit app", NULL, 50, 29},
+    UX_MENU_END};
+
+// keyslot that the APDU waiting for confirmation is about
+uint32_t apdu_keyslot;
+
+// sends the response to an APDU that was answered with IO_ASYNCH_REPLY,
+// once the user has made a decision on the device
+void apdu_reply(unsigned int tx, unsigned short sw) {
+    G_io_apdu_buffer[tx++] = sw >> 8;
+    G_io_apdu_buffer[tx++] = sw;
+    io_exchange(CHANNEL_APDU | IO_RETURN_AFTER_TX, tx);
+    UX_MENU_DISPLAY(0, menu_main, NULL);
+}
+
+// the approve callbacks run long after handle_apdu() has returned with
+// IO_ASYNCH_REPLY, so an exception from generating tokens (e.g. from
+// bump_bootcount()) has to be caught here and answered with an error, rather
+// than unwinding into sample_main() with the APDU still waiting for a reply
+void menu_confirm_otp_approve(unsigned int ignored) {
+    UNUSED(ignored);
+    uint8_t otp[OTP_TOKEN_RAW_LEN];
+    volatile unsigned int tx = 0;
+    volatile unsigned short sw = SW_OK;
+    BEGIN_TRY {
+        TRY {
+            generate_otp(apdu_keyslot, otp);
+            otp_print_token(otp, (char *)G_io_apdu_buffer);
+            tx = OTP_TOKEN_LEN;
+        }
+        CATCH_OTHER(e) {
+            sw = SW_DENIED;
+        }
+        FINALLY {
+        }
+    }
+    END_TRY;
+    apdu_reply(tx, sw);
+}
+
+// number of tokens asked for in GET_OTP_BATCH
+uint32_t apdu_batch_count;
+
+// status word to send along with a response, telling the host whether there
+// is more to fetch with GET_RESPONSE
+unsigned short response_status(void) {
+    uint32_t remaining;
+    uint32_t i;
+    switch (response_continuation.kind) {
+    case RESPONSE_EXPORT:
+        remaining = 2;
+        for (i = response_continuation.next; i < MAX_OTP_KEYSLOTS; i++) {
+            if (keyslot_occupied(i)) {
+                remaining += EXPORT_RECORD_LEN;
+            }
+        }
+        break;
+    case RESPONSE_OTP_BATCH:
+        remaining = 2 + response_continuation.remaining * OTP_TOKEN_RAW_LEN;
+        break;
+    case RESPONSE_IMPORT:
+        remaining = (import_count - response_continuation.next) *
+                    OTP_PRIVATE_ID_LEN;
+        break;
+    default:
+        return SW_OK;
+    }
+    return SW_BYTES_REMAINING | (remaining > 0xFF ? 0 : remaining);
+}
+
+// writes the next part of a GET_OTP_BATCH response: a flags byte and a token
+// count, followed by that many binary tokens (public ID and encrypted block).
+// as many tokens as fit into the APDU buffer are sent, or as many as are
+// left for this session.
+unsigned int otp_batch_chunk(void) {
+    uint32_t count = (sizeof(G_io_apdu_buffer) - 2 - 2) / OTP_TOKEN_RAW_LEN;
+    if (count > response_continuation.remaining) {
+        count = response_continuation.remaining;
+    }
+    if (count > otp_tokens_left()) {
+        count = otp_tokens_left();
+    }
+
+    uint32_t i;
+    unsigned int tx = 2;
+    for (i = 0; i < count; i++) {
+        generate_otp(apdu_keyslot, &G_io_apdu_buffer[tx]);
+        tx += OTP_TOKEN_RAW_LEN;
+    }
+    G_io_apdu_buffer[0] =
+        otp_tokens_left() < BATCH_TOKENS_LOW_THRESHOLD ? BATCH_FLAG_TOKENS_LOW
+                                                       : 0;
+    G_io_apdu_buffer[1] = count;
+
+    response_continuation.remaining -= count;
+    if (response_continuation.remaining == 0 || otp_tokens_left() == 0) {
+        clear_response_continuation();
+    }
+    return tx;
+}
+
+// GET_RESPONSE runs otp_batch_chunk() from handle_apdu(), where exceptions
+// are caught as usual. the keyslot has been bumped by then.
+void menu_confirm_otp_batch_approve(unsigned int ignored) {
+    UNUSED(ignored);
+    volatile unsigned int tx = 0;
+    volatile unsigned short sw = SW_OK;
+    response_continuation.kind = RESPONSE_OTP_BATCH;
+    response_continuation.remaining = apdu_batch_count;
+    BEGIN_TRY {
+        TRY {
+            tx = otp_batch_chunk();
+            sw = response_status();
+        }
+        CATCH_OTHER(e) {
+            clear_response_continuation();
+            tx = 0;
+            sw = SW_DENIED;
+        }
+        FINALLY {
+        }
+    }
+    END_TRY;
+    apdu_reply(tx, sw);
+}
+
+void menu_confirm_otp_reject(unsigned int ignored) {
+    UNUSED(ignored);
+    apdu_reply(0, SW_DENIED);
+}
+
+// writes the next part of an IMPORT_KEYSLOTS response: the private IDs of
+// the imported keyslots, in the order they were given in
+unsigned int import_chunk(void) {
+    unsigned int tx = 0;
+    while (response_continuation.next < import_count &&
+           tx + OTP_PRIVATE_ID_LEN <= sizeof(G_io_apdu_buffer) - 2) {
+        os_memmove(
+            &G_io_apdu_buffer[tx],
+            get_keyslot_secrets(
+                keyslot_order[import_first + response_continuation.next])
+                ->private_id,
+            OTP_PRIVATE_ID_LEN);
+        tx += OTP_PRIVATE_ID_LEN;
+        response_continuation.next++;
+    }
+    if (response_continuation.next == import_count) {
+        clear_response_continuation();
+    }
+    return tx;
+}
+
+// the records are already in their keyslots, see handle_import_keyslots(),
+// so all that is left is the bitmap that makes them appear
+void menu_confirm_import_approve(unsigned int ignored) {
+    UNUSED(ignored);
+    uint8_t occupied[sizeof(N_storage.occupied)];
+    uint32_t i;
+    os_memmove(occupied, N_storage.occupied, sizeof(occupied));
+    for (i = 0; i < import_count; i++) {
+        uint8_t which = keyslot_order[import_first + i];
+        occupied[which / 8] |= 1 << (which % 8);
+    }
+    storage_write(N_storage.occupied, occupied, sizeof(occupied));
+    keyslots_changed();
+
+    response_continuation.kind = RESPONSE_IMPORT;
+    response_continuation.next = 0;
+    unsigned int tx = import_chunk();
+    apdu_reply(tx, response_status());
+}
+
+char apdu_public_id[OTP_PUBLIC_ID_PRINTABLE_LEN + 1];
+const ux_menu_entry_t menu_confirm_otp[] = {
+    {NULL, NULL, 0, NULL, "Send OTP for", apdu_public_id, 0, 0},
+    {NULL, menu_confirm_otp_approve, 0, NULL, "Approve", NULL, 0, 0},
+    {NULL, menu_confirm_otp_reject, 0, NULL, "Reject", NULL, 0, 0},
     UX_MENU_END};
 
+const ux_menu_entry_t menu_confirm_otp_batch[] = {
+    {NULL, NULL, 0, NULL, "Send OTPs for", apdu_public_id, 0, 0},
+    {NULL, menu_confirm_otp_batch_approve, 0, NULL, "Approve", NULL, 0, 0},
+    {NULL, menu_confirm_otp_reject, 0, NULL, "Reject", NULL, 0, 0},
+    UX_MENU_END};
+
+char import_description[20];
+const ux_menu_entry_t menu_confirm_import[] = {
+    {NULL, NULL, 0, NULL, "Import keys", import_description, 0, 0},
+    {NULL, menu_confirm_import_approve, 0, NULL, "Approve", NULL, 0, 0},
+    {NULL, menu_confirm_otp_reject, 0, NULL, "Reject", NULL, 0, 0},
+    UX_MENU_END};
+
+uint32_t apdu_select_keyslot(uint8_t p1, uint8_t p2, uint8_t *data,
+                             uint32_t data_length) {
+    uint32_t which;
+    switch (p1) {
+    case P1_KEYSLOT_INDEX:
+        if (data_length != 0) {
+            THROW(SW_WRONG_LENGTH);
+        }
+        which = p2;
+        if (which >= MAX_OTP_KEYSLOTS || !keyslot_occupied(which)) {
+            THROW(SW_KEYSLOT_NOT_FOUND);
+        }
+        return which;
+    case P1_KEYSLOT_PUBLIC_ID:
+        if (p2 != 0) {
+            THROW(SW_WRONG_P1P2);
+        }
+        if (data_length != OTP_PUBLIC_ID_LEN) {
+            THROW(SW_WRONG_LENGTH);
+        }
+        which = find_keyslot_by_public_id(data);
+        if (which == -1U) {
+            THROW(SW_KEYSLOT_NOT_FOUND);
+        }
+        return which;
+    default:
+        THROW(SW_WRONG_P1P2);
+    }
+    return -1U;
+}
+
+// GET_OTP: returns the next printable token of a keyslot, once the user has
+// confirmed it on the device.
+// GET_OTP_BATCH: same, but returns binary tokens, as many as fit into one
+// APDU unless the data ends with an extra byte asking for a number of tokens.
+// the ones that don't fit are fetched with GET_RESPONSE.
+void handle_get_otp(uint8_t batch, uint8_t p1, uint8_t p2, uint8_t *data,
+                    uint32_t data_length, volatile unsigned int *flags) {
+    apdu_batch_count = (sizeof(G_io_apdu_buffer) - 2 - 2) / OTP_TOKEN_RAW_LEN;
+    if (batch &&
+        data_length ==
+            (p1 == P1_KEYSLOT_PUBLIC_ID ? OTP_PUBLIC_ID_LEN : 0) + 1) {
+        data_length--;
+        apdu_batch_count = data[data_length];
+        if (apdu_batch_count == 0) {
+            THROW(SW_WRONG_DATA);
+        }
+    }
+
+    apdu_keyslot = apdu_select_keyslot(p1, p2, data, data_length);
+    if (otp_tokens_left() == 0) {
+        THROW(SW_TOKENS_EXHAUSTED);
+    }
+
+    otp_print_public_id(&N_storage.keyslots[apdu_keyslot], apdu_public_id);
+    UX_MENU_DISPLAY(0, batch ? menu_confirm_otp_batch : menu_confirm_otp,
+                    NULL);
+    *flags |= IO_ASYNCH_REPLY;
+}
+
+// IMPORT_KEYSLOTS: adds keyslots with the given public IDs and boot counts.
+// called for every APDU of the command, each of which carries whole
+// records. they are written into free keyslots as they arrive, one write
+// per run of consecutive keyslots, so that an import of any size fits into
+// RAM, but stay free until the user approves
+// the whole import and a single write of the occupied bitmap makes them
+// appear. rejecting it leaves them free.
+// only the private IDs are returned, never the AES keys.
+void handle_import_keyslots(uint8_t first, uint8_t last, uint8_t p1,
+                            uint8_t p2, uint8_t *data, uint32_t data_length,
+                            volatile unsigned int *flags) {
+    if (p1 != 0 || p2 != 0) {
+        THROW(SW_WRONG_P1P2);
+    }
+    if (data_length % IMPORT_RECORD_LEN != 0) {
+        THROW(SW_WRONG_LENGTH);
+    }
+    if (first) {
+        import_first = keyslot_order_count;
+        import_count = 0;
+        import_interrupted = 0;
+    } else if (import_interrupted) {
+        THROW(SW_LAST_COMMAND_EXPECTED);
+    }
+
+    uint32_t count = data_length / IMPORT_RECORD_LEN;
+    uint32_t record;
+    for (record = 0; record < count; record++) {
+        uint8_t *public_id = &data[record * IMPORT_RECORD_LEN];
+        uint32_t i;
+        // a keyslot at the highest boot count could never be used, see
+        // bump_bootcount()
+        if (U2BE(public_id, OTP_PUBLIC_ID_LEN) == 0xFFFF) {
+            THROW(SW_WRONG_DATA);
+        }
+        // refuse public IDs that are already in use, including earlier in
+        // the same import, whether in an earlier APDU or in this one
+        if (find_keyslot_by_public_id(public_id) != -1U) {
+            THROW(SW_WRONG_DATA);
+        }
+        for (i = 0; i < import_count; i++) {
+            if (os_memcmp(
+                    N_storage.keyslots[keyslot_order[import_first + i]]
+                        .public_id,
+                    public_id, OTP_PUBLIC_ID_LEN) == 0) {
+                THROW(SW_WRONG_DATA);
+            }
+        }
+        for (i = 0; i < record; i++) {
+            if (os_memcmp(&data[i * IMPORT_RECORD_LEN], public_id,
+                          OTP_PUBLIC_ID_LEN) == 0) {
+                THROW(SW_WRONG_DATA);
+            }
+        }
+    }
+    // the free keyslots in keyslot_order, in turn, so that the new ones stay
+    // right behind the ones in use
+    if (import_first + import_count + count > MAX_OTP_KEYSLOTS) {
+        THROW(SW_NOT_ENOUGH_KEYSLOTS);
+    }
+
+    // the records become keyslots where they are, in the APDU buffer, and
+    // each run of them going into consecutive keyslots is written at once
+    for (record = 0; record < count; record++) {
+        uint8_t *keyslot = &data[record * IMPORT_RECORD_LEN];
+        uint16_t boot_count = U2BE(keyslot, OTP_PUBLIC_ID_LEN);
+        os_memmove(&keyslot[OTP_PUBLIC_ID_LEN], &boot_count,
+                   sizeof(uint16_t));
+    }
+    record = 0;
+    while (record < count) {
+        uint8_t *order = &keyslot_order[import_first + import_count];
+        uint32_t run = 1;
+        while (record + run < count && order[run] == order[0] + run) {
+            run++;
+        }
+        storage_write(&N_storage.keyslots[order[0]],
+                      &data[record * IMPORT_RECORD_LEN],
+                      run * sizeof(otpKeySlot_t));
+        record += run;
+        import_count += run;
+    }
+
+    if (!last) {
+        return;
+    }
+    if (import_count == 0) {
+        THROW(SW_WRONG_LENGTH);
+    }
+    snprintf(import_description, sizeof(import_description), "%d new keys",
+             (int)import_count);
+    UX_MENU_DISPLAY(0, menu_confirm_import, NULL);
+    *flags |= IO_ASYNCH_REPLY;
+}
+
+// writes the next part of an EXPORT_KEYSLOTS response: the number of tokens
+// generated this session and the index to continue from (EXPORT_END once
+// every keyslot has been listed), followed by as many keyslot records as fit
+// into the APDU buffer.
+unsigned int export_chunk(void) {
+    unsigned int tx = 2;
+    uint32_t i;
+    for (i = response_continuation.next; i < MAX_OTP_KEYSLOTS; i++) {
+        if (!keyslot_occupied(i)) {
+            continue;
+        }
+        otpKeySlot_t *key = &N_storage.keyslots[i];
+        if (tx + EXPORT_RECORD_LEN > sizeof(G_io_apdu_buffer) - 2) {
+            break;
+        }
+        G_io_apdu_buffer[tx++] = i;
+        os_memmove(&G_io_apdu_buffer[tx], key->public_id, OTP_PUBLIC_ID_LEN);
+        tx += OTP_PUBLIC_ID_LEN;
+        uint16_t boot_count = get_boot_count(i);
+        G_io_apdu_buffer[tx++] = boot_count >> 8;
+        G_io_apdu_buffer[tx++] = boot_count;
+    }
+    G_io_apdu_buffer[0] = otp_tokens_used();
+    G_io_apdu_buffer[1] = i < MAX_OTP_KEYSLOTS ? i : EXPORT_END;
+
+    response_continuation.next = i;
+    if (i >= MAX_OTP_KEYSLOTS) {
+        clear_response_continuation();
+    }
+    return tx;
+}
+
+// EXPORT_KEYSLOTS: lists the keyslots in use, starting from the index in P1.
+// returns the length of the response.
+unsigned int handle_export_keyslots(uint8_t p1, uint8_t p2,
+                                    uint32_t data_length) {
+    if (p2 != 0) {
+        THROW(SW_WRONG_P1P2);
+    }
+    if (data_length != 0) {
+        THROW(SW_WRONG_LENGTH);
+    }
+
+    response_continuation.kind = RESPONSE_EXPORT;
+    response_continuation.next = p1;
+    return export_chunk();
+}
+
+// GET_KEYSLOT_ORDER: returns the favourite keyslot (KEYSLOT_NONE if there is
+// none), then the keyslots in use in the order the menus list them.
+// returns the length of the response.
+unsigned int handle_get_keyslot_order(uint8_t p1, uint8_t p2,
+                                      uint32_t data_length) {
+    if (p1 != 0 || p2 != 0) {
+        THROW(SW_WRONG_P1P2);
+    }
+    if (data_length != 0) {
+        THROW(SW_WRONG_LENGTH);
+    }
+
+    G_io_apdu_buffer[0] = favourite_keyslot();
+    os_memmove(&G_io_apdu_buffer[1], keyslot_order, keyslot_order_count);
+    return 1 + keyslot_order_count;
+}
+
+// MOVE_KEYSLOT: moves keyslot P1 to position P2 of the menus
+void handle_move_keyslot(uint8_t p1, uint8_t p2, uint32_t data_length) {
+    if (data_length != 0) {
+        THROW(SW_WRONG_LENGTH);
+    }
+    if (p1 >= MAX_OTP_KEYSLOTS || !keyslot_occupied(p1)) {
+        THROW(SW_KEYSLOT_NOT_FOUND);
+    }
+    if (p2 >= keyslot_order_count) {
+        THROW(SW_WRONG_P1P2);
+    }
+
+    move_in_keyslot_order(keyslot_position(p1), p2);
+}
+
+// SET_FAVOURITE: makes keyslot P1 the favourite, or leaves no favourite if
+// P1 is KEYSLOT_NONE
+void handle_set_favourite(uint8_t p1, uint8_t p2, uint32_t data_length) {
+    if (p2 != 0) {
+        THROW(SW_WRONG_P1P2);
+    }
+    if (data_length != 0) {
+        THROW(SW_WRONG_LENGTH);
+    }
+    if (p1 != KEYSLOT_NONE &&
+        (p1 >= MAX_OTP_KEYSLOTS || !keyslot_occupied(p1))) {
+        THROW(SW_KEYSLOT_NOT_FOUND);
+    }
+
+    set_favourite(p1);
+}
+
+// GET_RESPONSE: returns the next part of the previous response.
+// returns the length of the response.
+unsigned int handle_get_response(uint8_t p1, uint8_t p2,
+                                 uint32_t data_length) {
+    if (p1 != 0 || p2 != 0) {
+        THROW(SW_WRONG_P1P2);
+    }
+    if (data_length != 0) {
+        THROW(SW_WRONG_LENGTH);
+    }
+
+    switch (response_continuation.kind) {
+    case RESPONSE_EXPORT:
+        return export_chunk();
+    case RESPONSE_OTP_BATCH:
+        return otp_batch_chunk();
+    case RESPONSE_IMPORT:
+        return import_chunk();
+    default:
+        THROW(SW_NO_RESPONSE_DATA);
+    }
+    return 0;
+}
+
+// data of a chained command, collected until its last APDU arrives. big
+// enough for the largest command collected this way, a GET_OTP_BATCH by
+// public ID. imports are taken an APDU at a time instead.
+uint8_t chain_buffer[OTP_PUBLIC_ID_LEN + 1];
+uint32_t chain_length;
+uint8_t chain_active;
+uint8_t chain_ins;
+uint8_t chain_p1;
+uint8_t chain_p2;
+
+// returns the length of the response already written to G_io_apdu_buffer,
+// if any
+unsigned int handle_apdu(unsigned int rx, volatile unsigned int *flags) {
+    uint8_t cla = G_io_apdu_buffer[OFFSET_CLA];
+    uint8_t ins = G_io_apdu_buffer[OFFSET_INS];
+    uint8_t p1 = G_io_apdu_buffer[OFFSET_P1];
+    uint8_t p2 = G_io_apdu_buffer[OFFSET_P2];
+    uint8_t *data = &G_io_apdu_buffer[OFFSET_CDATA];
+
+    if ((cla & ~CLA_CHAINING) != CLA) {
+        THROW(SW_CLA_NOT_SUPPORTED);
+    }
+
+    // a single byte after the header is Le, as in an ISO 7816 GET RESPONSE
+    // with the length from the previous 61XX. responses are sent whole
+    // anyway, so it is ignored.
+    uint32_t data_length = 0;
+    if (rx > OFFSET_CDATA) {
+        data_length = G_io_apdu_buffer[OFFSET_LC];
+        if (rx != OFFSET_CDATA + data_length) {
+            THROW(SW_WRONG_LENGTH);
+        }
+    }
+
+    if (ins != INS_GET_RESPONSE) {
+        clear_response_continuation();
+    }
+
+    // every APDU of a chain has to be for the same command, and the command
+    // only runs once the last one has arrived
+    if (chain_active &&
+        (ins != chain_ins || p1 != chain_p1 || p2 != chain_p2)) {
+        chain_active = 0;
+        THROW(SW_LAST_COMMAND_EXPECTED);
+    }
+    // the records of an import are written as they arrive, see
+    // handle_import_keyslots(), so only the chain itself is kept track of
+    if (ins == INS_IMPORT_KEYSLOTS) {
+        uint8_t first = !chain_active;
+        chain_active = 0;
+        handle_import_keyslots(first, !(cla & CLA_CHAINING), p1, p2, data,
+                               data_length, flags);
+        if (cla & CLA_CHAINING) {
+            chain_active = 1;
+            chain_ins = ins;
+            chain_p1 = p1;
+            chain_p2 = p2;
+        }
+        return 0;
+    }
+    if ((cla & CLA_CHAINING) || chain_active) {
+        if (!chain_active) {
+            chain_active = 1;
+            chain_length = 0;
+            chain_ins = ins;
+            chain_p1 = p1;
+            chain_p2 = p2;
+        }
+        if (chain_length + data_length > sizeof(chain_buffer)) {
+            chain_active = 0;
+            THROW(SW_WRONG_LENGTH);
+        }
+        os_memmove(&chain_buffer[chain_length], data, data_length);
+        chain_length += data_length;
+        if (cla & CLA_CHAINING) {
+            return 0;
+        }
+        chain_active = 0;
+        data = chain_buffer;
+        data_length = chain_length;
+    }
+
+    switch (ins) {
+    case INS_GET_OTP:
+    case INS_GET_OTP_BATCH:
+        handle_get_otp(ins == INS_GET_OTP_BATCH, p1, p2, data, data_length,
+                       flags);
+        break;
+
+    case INS_EXPORT_KEYSLOTS:
+        return handle_export_keyslots(p1, p2, data_length);
+
+    case INS_GET_KEYSLOT_ORDER:
+        return handle_get_keyslot_order(p1, p2, data_length);
+
+    case INS_MOVE_KEYSLOT:
+        handle_move_keyslot(p1, p2, data_length);
+        break;
+
+    case INS_SET_FAVOURITE:
+        handle_set_favourite(p1, p2, data_length);
+        break;
+
+    case INS_GET_RESPONSE:
+        return handle_get_response(p1, p2, data_length);
+
+    default:
+        THROW(SW_INS_NOT_SUPPORTED);
+    }
+    return 0;
+}
+
 unsigned short io_exchange_al(unsigned char channel, unsigned short tx_len) {
     switch (channel & ~(IO_FLAGS)) {
     case CHANNEL_KEYBOARD:
@@ -343,12 +1710,10 @@ void sample_main(void) {
                     THROW(0x6982);
                 }
 
-                if (G_io_apdu_buffer[0] != CLA) {
-                    THROW(0x6E00);
-                }
+                tx = handle_apdu(rx, &flags);
 
-                // default no error
-                THROW(0x9000);
+                // default no error, possibly with more to come
+                THROW(response_status());
             }
             CATCH_OTHER(e) {
                 switch (e & 0xFFFFF000) {
@@ -380,8 +1745,43 @@ void sample_main(void) {
     return;
 }
 
-// override point, but nothing more to do
+// the state of ux_menu when the screen was last drawn, whether by the
+// ticker or by ux_menu itself reacting to a button
+typedef struct displayedMenu_t {
+    const ux_menu_entry_t *menu_entries;
+    unsigned int menu_entries_count;
+    unsigned int current_entry;
+    ux_menu_iterator_t menu_iterator;
+} displayedMenu_t;
+
+displayedMenu_t displayed_menu;
+
+void forget_displayed_menu(void) {
+    os_memset(&displayed_menu, 0, sizeof(displayed_menu));
+    display_changed();
+}
+
+// whether the screen has to be redrawn: the menu, the entry or the number of
+// entries changed since it was drawn, or display_changed() was called.
+// the only animation, scrolling a long label, is redrawn separately from
+// the UX_TICKER_EVENT() callback when its interval runs out.
+uint8_t display_outdated(void) {
+    return display_dirty ||
+           displayed_menu.menu_entries != ux_menu.menu_entries ||
+           displayed_menu.menu_entries_count != ux_menu.menu_entries_count ||
+           displayed_menu.current_entry != ux_menu.current_entry ||
+           displayed_menu.menu_iterator != ux_menu.menu_iterator;
+}
+
+// every element drawn goes through here, so this is where the screen
+// catches up with ux_menu
 void io_seproxyhal_display(const bagl_element_t *element) {
+    PROBE_INC(PROBE_DISPLAY_PACKETS);
+    displayed_menu.menu_entries = ux_menu.menu_entries;
+    displayed_menu.menu_entries_count = ux_menu.menu_entries_count;
+    displayed_menu.current_entry = ux_menu.current_entry;
+    displayed_menu.menu_iterator = ux_menu.menu_iterator;
+    display_dirty = 0;
     io_seproxyhal_display_default((bagl_element_t *)element);
 }
 
@@ -415,11 +1815,32 @@ unsigned char io_event(unsigned char channel) {
         break;
 
     case SEPROXYHAL_TAG_TICKER_EVENT:
+        probe_tick();
         UX_TICKER_EVENT(G_io_seproxyhal_spi_buffer, {
             if (UX_ALLOWED) {
+                // next step of a scrolling label
                 UX_REDISPLAY();
             }
         });
+        if (usb_restart_pending && !usb_kbd_busy()) {
+            restart_usb();
+        }
+        // the idle work is done on every ticker event, after the SDK's own
+        // handling of it. the callback above only runs when the interval
+        // armed for scrolling a label runs out, and none of the usual
+        // screens have such labels.
+        if (UX_ALLOWED) {
+            precompute_keys();
+            if (ux_menu.menu_iterator == menu_entries_iterator) {
+                fill_public_id_cache(ux_menu.current_entry);
+            }
+            if (display_outdated()) {
+                UX_REDISPLAY();
+            }
+        } else {
+            // something else is on screen, ours needs drawing afterwards
+            display_changed();
+        }
     }
 
     // close the event if not done previously (by a display or whatever)
@@ -432,6 +1853,8 @@ unsigned char io_event(unsigned char channel) {
 }
 
 void app_exit(void) {
+    clear_key_caches();
+
     BEGIN_TRY_L(exit) {
         TRY_L(exit) {
             os_sched_exit(-1);
@@ -455,15 +1878,31 @@ __attribute__((section(".boot"))) int main(void) {
         TRY {
             io_seproxyhal_init();
 
+            // the probes printed below cover starting the app
+            probe_reset();
+
             if (N_storage.magic != STORAGE_MAGIC) {
                 uint32_t magic;
                 magic = STORAGE_MAGIC;
-                nvm_write(&N_storage.magic, (void *)&magic, sizeof(uint32_t));
+                storage_write(&N_storage.magic, (void *)&magic, sizeof(uint32_t));
                 reset_keyslots();
+                storage_write(&N_storage.typing_profile, NULL, sizeof(uint8_t));
             }
 
-            increment_bootcounts();
+            find_journal_head();
+            clear_bumped_keyslots();
+            load_keyslot_order();
+            keyslots_changed();
             otp_reset_token_counter();
+            clear_key_caches();
+            restart_precompute();
+            clear_response_continuation();
+            chain_active = 0;
+            forget_displayed_menu();
+            usb_kbd_init();
+            usb_kbd_set_profile(N_storage.typing_profile);
+            usb_restart_pending = 0;
+            probe_print();
 
             USB_power(1);
 
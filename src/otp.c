@@ -21,6 +21,7 @@
 #include "cx.h"
 
 #include "ctr_drbg.h"
+#include "probe.h"
 
 static const char hex_alphabet[] = "0123456789abcdef";
 void bytes_to_hex(uint8_t* bytes, uint32_t length, char* out) {
@@ -54,42 +55,39 @@ void bytes_to_modhex(uint8_t* bytes, uint32_t length, char* out) {
   from this it follows that for any b <= 0xff,
   if CRC(x) = 0x0f87 ^ b, then CRC(x + [b]) = 0xf0b8.
 
-  so we just bruteforce the first byte until the CRC of the original data
-  + this byte becomes 0x0f**, then use the observation above to get the
-  second byte.
+  appending a byte b to a string with CRC c gives the CRC
+  (c >> 8) ^ T[(c ^ b) & 0xff], where T is the usual byte-wise table for
+  the polynomial 0x8408. the high bytes of T are all distinct, and the
+  only entry with a high byte of 0x0f is T[0xff] = 0x0f78, so the first
+  byte has to be (c & 0xff) ^ 0xff. this brings the CRC to
+  0x0f00 | ((c >> 8) ^ 0x78), and the observation above then gives
+  (c >> 8) ^ 0x78 ^ 0x87 = (c >> 8) ^ 0xff as the second byte.
+
+  in other words, the two bytes are just the complement of the CRC of the
+  original data, least significant byte first. this is the same pair that
+  bruteforcing the first byte from 0 upwards used to find.
 */
 
+// CRC of each 4-bit value, processed least significant bit first.
+// 32 bytes instead of the 512 a full byte-wise table would take.
+static const uint16_t otp_crc_nibble_table[16] = {
+    0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+    0x8408, 0x9489, 0xa50a, 0xb58b, 0xc60c, 0xd68d, 0xe70e, 0xf78f};
+
 static uint16_t otp_crc(uint8_t *data, uint32_t length, uint16_t crc) {
     uint32_t i;
     for (i = 0; i < length; i++) {
         crc ^= data[i];
-        uint8_t j;
-        for (j = 0; j < 8; j++) {
-            uint16_t n = crc & 1;
-            crc >>= 1;
-            if (n) {
-                crc ^= 0x8408;
-            }
-        }
+        crc = (crc >> 4) ^ otp_crc_nibble_table[crc & 0xf];
+        crc = (crc >> 4) ^ otp_crc_nibble_table[crc & 0xf];
     }
     return crc;
 }
 
 static void otp_crc_forge_0xf0b8(uint8_t *data, uint32_t length) {
     uint16_t partial_crc = otp_crc(data, length, 0xffff);
-    // unsigned overflows are *not* undefined behavior.
-    // ++x == 0 will be true only when x == 255.
-    // besides, this loop will return before this is reached.
-    data[length] = 0;
-    do {
-        uint16_t crc = otp_crc(&data[length], 1, partial_crc);
-        if (crc >> 8 == 0x0f) {
-            data[length + 1] = 0x87 ^ (crc & 0xff);
-            return;
-        }
-    } while (++data[length] != 0);
-
-    THROW(EXCEPTION);
+    data[length] = ~partial_crc & 0xff;
+    data[length + 1] = (~partial_crc >> 8) & 0xff;
 }
 
 
@@ -98,17 +96,23 @@ static void otp_crc_forge_0xf0b8(uint8_t *data, uint32_t length) {
 // architecture
 uint8_t token_count_since_boot;
 
-void otp_generate_token(otpKeySlot_t* key, char* token) {
+// tokens are generated in binary form first: the public ID, followed by the
+// encrypted block (OTP_TOKEN_RAW_LEN bytes in total). otp_print_token() turns
+// that into the usual modhex string.
+
+// first half of generating a token: fills in everything that doesn't depend
+// on the key's secrets, and writes the public ID part of the token.
+// this already uses up a value of the session counter, so the token should
+// always be finished with otp_finalize_token().
+void otp_prepare_token(otpKeySlot_t* key, otpPendingToken_t* pending,
+                       uint8_t* token) {
     if (token_count_since_boot == 255) {
         THROW(EXCEPTION);
     }
 
-    otpKeySecrets_t secrets;
-    otp_derive_keys(key, &secrets);
-
-    uint8_t plaintext[OTP_PRIVATE_ID_LEN + 2 + 3 + 1 + 4];
-    // private ID
-    os_memmove(&plaintext[0], secrets.private_id, OTP_PRIVATE_ID_LEN);
+    uint8_t *plaintext = pending->plaintext;
+    // private ID, filled in by otp_finalize_token()
+    os_memset(&plaintext[0], 0, OTP_PRIVATE_ID_LEN);
     // boot count, 2 bytes
     plaintext[OTP_PRIVATE_ID_LEN] = key->boot_count & 0xff;
     plaintext[OTP_PRIVATE_ID_LEN + 1] = key->boot_count >> 8;
@@ -124,23 +128,75 @@ void otp_generate_token(otpKeySlot_t* key, char* token) {
     // counter, 1 byte
     plaintext[OTP_PRIVATE_ID_LEN + 5] = token_count_since_boot;
     // junk, 4 bytes
-    // we insert two random bytes, then compute the other two to get the correct CRC16
+    // we insert two random bytes here, the other two are computed by
+    // otp_finalize_token() to get the correct CRC16
     plaintext[OTP_PRIVATE_ID_LEN + 6] = cx_rng_u8();
     plaintext[OTP_PRIVATE_ID_LEN + 6 + 1] = cx_rng_u8();
-    otp_crc_forge_0xf0b8(plaintext, OTP_PRIVATE_ID_LEN + 2 + 3 + 1 + 2);
 
+    os_memmove(&token[0], key->public_id, OTP_PUBLIC_ID_LEN);
+
+    token_count_since_boot++;
+}
+
+// second half of generating a token: adds the private ID and the CRC, then
+// encrypts the result into the rest of the token.
+// aes_key has to be the AES key from secrets, already set up with
+// cx_aes_init_key(), so that callers can reuse it across tokens.
+void otp_finalize_token(otpPendingToken_t* pending, otpKeySecrets_t* secrets,
+                        cx_aes_key_t* aes_key, uint8_t* token) {
+    uint8_t *plaintext = pending->plaintext;
+    os_memmove(&plaintext[0], secrets->private_id, OTP_PRIVATE_ID_LEN);
+    otp_crc_forge_0xf0b8(plaintext, OTP_TOKEN_PLAINTEXT_LEN - 2);
+
+    PROBE_INC(PROBE_AES_BLOCKS);
+    cx_aes(aes_key, CX_ENCRYPT | CX_PAD_NONE | CX_CHAIN_ECB,
+        plaintext, OTP_TOKEN_PLAINTEXT_LEN,
+        &token[OTP_PUBLIC_ID_LEN]);
+    os_memset(plaintext, 0, OTP_TOKEN_PLAINTEXT_LEN);
+}
+
+void otp_generate_token_raw(otpKeySlot_t* key, otpKeySecrets_t* secrets,
+                            cx_aes_key_t* aes_key, uint8_t* token) {
+    otpPendingToken_t pending;
+    otp_prepare_token(key, &pending, token);
+    otp_finalize_token(&pending, secrets, aes_key, token);
+}
+
+void otp_generate_token(otpKeySlot_t* key, otpKeySecrets_t* secrets,
+                        cx_aes_key_t* aes_key, char* token) {
+    uint8_t token_bytes[OTP_TOKEN_RAW_LEN];
+    otp_generate_token_raw(key, secrets, aes_key, token_bytes);
+    otp_print_token(token_bytes, token);
+}
+
+void otp_print_token(uint8_t* token_bytes, char* token) {
+    bytes_to_modhex(token_bytes, OTP_TOKEN_RAW_LEN, token);
+}
+
+// generates n consecutive tokens for the key, deriving its secrets and
+// setting up AES only once.
+// the tokens are written to out back to back, followed by a terminating zero,
+// so out needs room for n * OTP_TOKEN_LEN + 1 characters.
+// like the single token functions, this leaves the key's boot count alone:
+// callers bump it before the first token of the session, as for any token.
+void otp_generate_tokens(otpKeySlot_t* key, uint32_t n, char* out) {
+    // don't start a batch that can't be finished
+    if (n > 255 - token_count_since_boot) {
+        THROW(EXCEPTION);
+    }
+
+    otpKeySecrets_t secrets;
     cx_aes_key_t aes_key;
+    otp_derive_keys(key, &secrets);
     cx_aes_init_key(secrets.aes_key, OTP_AES_KEY_LEN, &aes_key);
-    uint8_t token_bytes[OTP_PRIVATE_ID_LEN + 2 + 3 + 1 + 4];
-    cx_aes(&aes_key, CX_ENCRYPT | CX_PAD_NONE | CX_CHAIN_ECB,
-        plaintext, OTP_PRIVATE_ID_LEN + 2 + 3 + 1 + 4,
-        token_bytes);
 
-    otp_print_public_id(key, &token[0]);
-    bytes_to_modhex(token_bytes, OTP_PRIVATE_ID_LEN + 2 + 3 + 1 + 4,
-        &token[OTP_PUBLIC_ID_PRINTABLE_LEN]);
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        otp_generate_token(key, &secrets, &aes_key, &out[i * OTP_TOKEN_LEN]);
+    }
 
-    token_count_since_boot++;
+    os_memset(&secrets, 0, sizeof(secrets));
+    os_memset(&aes_key, 0, sizeof(aes_key));
 }
 
 void otp_print_public_id(otpKeySlot_t* key, char* public_id) {
@@ -148,7 +204,6 @@ void otp_print_public_id(otpKeySlot_t* key, char* public_id) {
 }
 
 void otp_initialize_key(otpKeySlot_t* key) {
-    key->enabled = 1;
     key->boot_count = 1;
     cx_rng(key->public_id, OTP_PUBLIC_ID_LEN);
 }
@@ -206,3 +261,11 @@ void otp_print_aes_key(otpKeySecrets_t* secrets, char* key1, char* key2, char* k
 void otp_reset_token_counter() {
     token_count_since_boot = 0;
 }
+
+uint32_t otp_tokens_left() {
+    return 255 - token_count_since_boot;
+}
+
+uint32_t otp_tokens_used() {
+    return token_count_since_boot;
+}
@@ -0,0 +1,64 @@
+/*
+    Yubico OTP implementation for the Ledger Nano S (nanos-app-yubico-otp)
+    (c) 2017 Aleksejs Popovs <aleksejs@popovs.lv>
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include "probe.h"
+
+#ifdef HAVE_PROBES
+
+#include "os.h"
+
+uint32_t probe_counters[PROBE_COUNT];
+
+static const char *const probe_names[PROBE_COUNT] = {
+    "aes blocks",
+    "aes key expansions",
+    "nvm writes",
+    "nvm bytes written",
+    "display packets",
+};
+
+// ticker events arrive every 100 ms
+#define PROBE_TICKS_PER_MINUTE 600
+
+static uint32_t probe_ticks;
+
+void probe_reset(void) {
+    os_memset(probe_counters, 0, sizeof(probe_counters));
+    probe_ticks = 0;
+}
+
+void probe_print(void) {
+    uint32_t i;
+    for (i = 0; i < PROBE_COUNT; i++) {
+        PRINTF("%s: %d\n", (const char *)PIC(probe_names[i]),
+               probe_counters[i]);
+    }
+}
+
+// called on every ticker event. the display is busy all the time rather than
+// in bursts, so its packets are printed and counted again once a minute.
+void probe_tick(void) {
+    if (++probe_ticks < PROBE_TICKS_PER_MINUTE) {
+        return;
+    }
+    PRINTF("display packets per minute: %d\n",
+           probe_counters[PROBE_DISPLAY_PACKETS]);
+    probe_counters[PROBE_DISPLAY_PACKETS] = 0;
+    probe_ticks = 0;
+}
+
+#endif
@@ -27,64 +27,97 @@
 #include "usb_keyboard.h"
 
 extern unsigned char G_io_seproxyhal_spi_buffer[IO_SEPROXYHAL_BUFFER_SIZE_B];
-static void io_usb_send_data(uint8_t endpoint, unsigned char *buffer,
-                      unsigned short length) {
-    unsigned int rx_len;
 
-    // won't send if overflowing seproxyhal buffer format
-    if (length > 255) {
+#define KBD_ENDPOINT 1
+#define KBD_REPORT_LEN 8
+
+/*
+  keyboard reports are queued here and sent one at a time, the next one going
+  out when the previous transfer is acknowledged (usb_kbd_report_sent() is
+  called for that from the HID class). this way typing doesn't block the UI
+  and the next reports can be prepared while one is in flight.
+  the report at queue_head is the one being sent if report_in_flight is set.
+*/
+#define KBD_QUEUE_SIZE 16
+
+static uint8_t queue[KBD_QUEUE_SIZE][KBD_REPORT_LEN];
+static uint8_t queue_head;
+static uint8_t queue_length;
+static uint8_t report_in_flight;
+
+static void io_usb_send_report(uint8_t endpoint, const uint8_t *report) {
+    // header and payload go out in a single SPI packet
+    uint8_t buffer[6 + KBD_REPORT_LEN];
+    buffer[0] = SEPROXYHAL_TAG_USB_EP_PREPARE;
+    buffer[1] = (3 + KBD_REPORT_LEN) >> 8;
+    buffer[2] = (3 + KBD_REPORT_LEN);
+    buffer[3] = 0x80 | endpoint;
+    buffer[4] = SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_IN;
+    buffer[5] = KBD_REPORT_LEN;
+    os_memmove(&buffer[6], report, KBD_REPORT_LEN);
+    io_seproxyhal_spi_send(buffer, sizeof(buffer));
+}
+
+static void kbd_start_transfer(void) {
+    if (report_in_flight || queue_length == 0) {
         return;
     }
+    report_in_flight = 1;
+    io_usb_send_report(KBD_ENDPOINT, queue[queue_head]);
+}
 
-    G_io_seproxyhal_spi_buffer[0] = SEPROXYHAL_TAG_USB_EP_PREPARE;
-    G_io_seproxyhal_spi_buffer[1] = (3 + length) >> 8;
-    G_io_seproxyhal_spi_buffer[2] = (3 + length);
-    G_io_seproxyhal_spi_buffer[3] = 0x80 | endpoint;
-    G_io_seproxyhal_spi_buffer[4] = SEPROXYHAL_TAG_USB_EP_PREPARE_DIR_IN;
-    G_io_seproxyhal_spi_buffer[5] = length;
-    io_seproxyhal_spi_send(G_io_seproxyhal_spi_buffer, 6);
-    io_seproxyhal_spi_send(buffer, length);
-
-    for (;;) {
+// runs the event loop until there is room in the queue. this is only needed
+// when more reports are queued at once than the queue can hold.
+static void kbd_wait_for_room(void) {
+    while (queue_length == KBD_QUEUE_SIZE) {
         if (!io_seproxyhal_spi_is_status_sent()) {
             io_seproxyhal_general_status();
         }
 
-        rx_len = io_seproxyhal_spi_recv(G_io_seproxyhal_spi_buffer,
-                                        sizeof(G_io_seproxyhal_spi_buffer), 0);
-
-        // wait for ack of the seproxyhal
-        // discard if not an acknowledgment
-        if (G_io_seproxyhal_spi_buffer[0] != SEPROXYHAL_TAG_USB_EP_XFER_EVENT ||
-            rx_len != 6 || G_io_seproxyhal_spi_buffer[3] != (0x80 | endpoint) ||
-            G_io_seproxyhal_spi_buffer[4] != SEPROXYHAL_TAG_USB_EP_XFER_IN ||
-            G_io_seproxyhal_spi_buffer[5] != length) {
-            // usb reset ?
-            io_seproxyhal_handle_usb_event();
-
-            // link disconnected ?
-            if (G_io_seproxyhal_spi_buffer[0] == SEPROXYHAL_TAG_STATUS_EVENT) {
-                if (!(U4BE(G_io_seproxyhal_spi_buffer, 3) &
-                      SEPROXYHAL_TAG_STATUS_EVENT_FLAG_USB_POWERED)) {
-                    THROW(EXCEPTION_IO_RESET);
-                }
-            }
+        io_seproxyhal_spi_recv(G_io_seproxyhal_spi_buffer,
+                               sizeof(G_io_seproxyhal_spi_buffer), 0);
 
-            if (!io_event(CHANNEL_SPI)) {
-                // THROW ??
+        // link disconnected ?
+        if (G_io_seproxyhal_spi_buffer[0] == SEPROXYHAL_TAG_STATUS_EVENT) {
+            if (!(U4BE(G_io_seproxyhal_spi_buffer, 3) &
+                  SEPROXYHAL_TAG_STATUS_EVENT_FLAG_USB_POWERED)) {
+                usb_kbd_init();
+                THROW(EXCEPTION_IO_RESET);
             }
+        }
 
-            if (!io_seproxyhal_spi_is_status_sent()) {
-                io_seproxyhal_general_status();
-            }
+        // usb events, including transfer acknowledgments, are dispatched to
+        // the HID class, everything else goes to the application
+        if (!io_seproxyhal_handle_event()) {
+            io_event(CHANNEL_SPI);
+        }
 
-            // no general status ack, io_event is responsible for it
-            continue;
+        if (!io_seproxyhal_spi_is_status_sent()) {
+            io_seproxyhal_general_status();
         }
+    }
+}
+
+static void kbd_queue_report(const uint8_t *report) {
+    kbd_wait_for_room();
+    os_memmove(queue[(queue_head + queue_length) % KBD_QUEUE_SIZE], report,
+               KBD_REPORT_LEN);
+    queue_length++;
+    kbd_start_transfer();
+}
 
-        // chunk sending succeeded
-        break;
+void usb_kbd_report_sent(void) {
+    if (!report_in_flight) {
+        return;
     }
+    report_in_flight = 0;
+    queue_head = (queue_head + 1) % KBD_QUEUE_SIZE;
+    queue_length--;
+    kbd_start_transfer();
+}
+
+uint8_t usb_kbd_busy(void) {
+    return queue_length != 0;
 }
 
 #define KEYCODE_START 0x20
@@ -118,11 +151,23 @@ static const uint8_t MAP_KEY_CODE[] = {
     0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16,
     0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x2f, 0x31, 0x30, 0x35};
 
-static const uint8_t EMPTY_REPORT[] = {0x00, 0x00, 0x00, 0x00,
-                                       0x00, 0x00, 0x00, 0x00};
+// key codes for the modhex alphabet "cbdefghijklnrtuv", indexed by nibble.
+// these are the MAP_KEY_CODE entries of those letters, none of which need
+// any modifiers.
+#define LETTER_KEY_CODE(ch) (0x04 + (ch) - 'a')
+static const uint8_t MODHEX_KEY_CODE[16] = {
+    LETTER_KEY_CODE('c'), LETTER_KEY_CODE('b'), LETTER_KEY_CODE('d'),
+    LETTER_KEY_CODE('e'), LETTER_KEY_CODE('f'), LETTER_KEY_CODE('g'),
+    LETTER_KEY_CODE('h'), LETTER_KEY_CODE('i'), LETTER_KEY_CODE('j'),
+    LETTER_KEY_CODE('k'), LETTER_KEY_CODE('l'), LETTER_KEY_CODE('n'),
+    LETTER_KEY_CODE('r'), LETTER_KEY_CODE('t'), LETTER_KEY_CODE('u'),
+    LETTER_KEY_CODE('v')};
+
+static const uint8_t EMPTY_REPORT[KBD_REPORT_LEN] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
-static void char_to_report(char key, uint8_t *out) {
-    uint8_t bm_byte, bm_bit, key_code, alt_used, shift_used;
+static void char_to_key(char key, uint8_t *modifiers, uint8_t *key_code) {
+    uint8_t bm_byte, bm_bit, alt_used, shift_used;
 
     if (key < KEYCODE_START) {
         THROW(EXCEPTION);
@@ -131,36 +176,191 @@ static void char_to_report(char key, uint8_t *out) {
     if (key > MAPPING_LENGTH) {
         THROW(EXCEPTION);
     }
-    key_code = MAP_KEY_CODE[key];
+    *key_code = MAP_KEY_CODE[(uint8_t)key];
 
     bm_byte = key >> 3;
     bm_bit = 1 << (key & 0x07);
     alt_used = ((MAP_ALT[bm_byte] & bm_bit) != 0);
     shift_used = ((MAP_SHIFT[bm_byte] & bm_bit) != 0);
 
-    out[0] = (alt_used ? 0x40 : 0x00) | (shift_used ? 0x02 : 0x00);
-    out[1] = 0x00;
-    out[2] = key_code;
+    *modifiers = (alt_used ? 0x40 : 0x00) | (shift_used ? 0x02 : 0x00);
+}
+
+/*
+  typing profiles trade speed for compatibility: some KVM switches and remote
+  desktop clients lose keys when several are pressed in one report, or when
+  reports follow each other too quickly.
+
+  spacing is done by sending every report several times. repeating a report
+  doesn't change anything for the host, but each copy takes up one polling
+  interval of the endpoint.
+*/
+typedef struct typingProfile_t {
+    // how many keys can be pressed in a single report
+    uint8_t keys_per_report;
+    // whether every report is followed by an empty one
+    uint8_t release_each_report;
+    // how many times every report is sent
+    uint8_t repeat;
+    // bInterval of the keyboard endpoint, in milliseconds
+    uint8_t polling_interval;
+} typingProfile_t;
+
+static const typingProfile_t TYPING_PROFILES[TYPING_PROFILE_COUNT] = {
+    // TYPING_PROFILE_COMPATIBLE
+    {1, 1, 1, 1},
+    // TYPING_PROFILE_FAST
+    {6, 0, 1, 1},
+    // TYPING_PROFILE_SLOW
+    {1, 1, 3, 10},
+};
+
+static uint8_t typing_profile;
+
+#define PROFILE (TYPING_PROFILES[typing_profile])
+
+void usb_kbd_set_profile(uint8_t profile) {
+    if (profile >= TYPING_PROFILE_COUNT) {
+        profile = TYPING_PROFILE_COMPATIBLE;
+    }
+    typing_profile = profile;
+}
+
+uint8_t usb_kbd_polling_interval(void) {
+    return PROFILE.polling_interval;
+}
+
+/*
+  the boot keyboard report has room for six keys at once, and hosts handle
+  the keys that are newly pressed in a report in the order they appear in.
+  so instead of sending a key-down and an empty report for every character,
+  we collect characters into one report as long as they
+
+  - use the same modifiers,
+  - are all distinct,
+  - and weren't already held down in the previous report (the host would
+    just see them as still pressed),
+
+  and only send an empty report in between when a character repeats.
+  (unless the typing profile asks for something more conservative.)
+*/
+
+// report being filled in, and how many keys it has so far
+static uint8_t report[KBD_REPORT_LEN];
+static uint8_t report_keys;
+// the last report that was queued for the host
+static uint8_t pressed[KBD_REPORT_LEN];
+
+static uint8_t report_has_key(uint8_t *r, uint8_t key_code) {
+    uint8_t i;
+    for (i = 2; i < KBD_REPORT_LEN; i++) {
+        if (r[i] == key_code) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void kbd_send(const uint8_t *r) {
+    uint8_t i;
+    for (i = 0; i < PROFILE.repeat; i++) {
+        kbd_queue_report(r);
+    }
+}
+
+static void kbd_release(void);
+
+static void kbd_flush(void) {
+    if (report_keys == 0) {
+        return;
+    }
+    kbd_send(report);
+    os_memmove(pressed, report, KBD_REPORT_LEN);
+    os_memset(report, 0, KBD_REPORT_LEN);
+    report_keys = 0;
+    if (PROFILE.release_each_report) {
+        kbd_release();
+    }
+}
+
+static void kbd_release(void) {
+    kbd_flush();
+    if (os_memcmp(pressed, EMPTY_REPORT, KBD_REPORT_LEN) != 0) {
+        kbd_send(EMPTY_REPORT);
+        os_memset(pressed, 0, KBD_REPORT_LEN);
+    }
+}
+
+static void kbd_press(uint8_t modifiers, uint8_t key_code) {
+    if (report_keys == PROFILE.keys_per_report ||
+        (report_keys != 0 && report[0] != modifiers) ||
+        report_has_key(report, key_code)) {
+        kbd_flush();
+    }
+    if (report_has_key(pressed, key_code)) {
+        if (report_keys != 0) {
+            // the report about to be sent replaces the one with this key
+            kbd_flush();
+        } else {
+            kbd_release();
+        }
+    }
+    report[0] = modifiers;
+    report[2 + report_keys] = key_code;
+    report_keys++;
+}
+
+static void kbd_press_char(char ch) {
+    uint8_t modifiers, key_code;
+    char_to_key(ch, &modifiers, &key_code);
+    kbd_press(modifiers, key_code);
+}
+
+void usb_kbd_init(void) {
+    os_memset(report, 0, sizeof(report));
+    os_memset(pressed, 0, sizeof(pressed));
+    report_keys = 0;
+    queue_head = 0;
+    queue_length = 0;
+    report_in_flight = 0;
+}
+
+void usb_kbd_cancel(void) {
+    // drop everything but the report that is already in flight
+    queue_length = report_in_flight;
+    os_memset(report, 0, sizeof(report));
+    report_keys = 0;
+    // and make sure the host doesn't end up with keys held down
+    if (report_in_flight ||
+        os_memcmp(pressed, EMPTY_REPORT, KBD_REPORT_LEN) != 0) {
+        kbd_send(EMPTY_REPORT);
+        os_memset(pressed, 0, KBD_REPORT_LEN);
+    }
 }
 
 void usb_kbd_send_char(char ch) {
-    uint8_t report[8] = {};
-    char_to_report(ch, report);
-    io_usb_send_data(1, report, 8);
-    io_usb_send_data(1, EMPTY_REPORT, 8);
+    kbd_press_char(ch);
+    kbd_release();
 }
 
 void usb_kbd_send_string(char* s) {
-    uint8_t report[8] = {};
     for (; *s; s++) {
-        char_to_report(*s, report);
-        io_usb_send_data(1, report, 8);
-        io_usb_send_data(1, EMPTY_REPORT, 8);
+        kbd_press_char(*s);
+    }
+    kbd_release();
+}
+
+// types the bytes as modhex, going straight from nibbles to key codes
+void usb_kbd_send_modhex(uint8_t* bytes, uint32_t length) {
+    uint32_t i;
+    for (i = 0; i < length; i++) {
+        kbd_press(0, MODHEX_KEY_CODE[bytes[i] >> 4]);
+        kbd_press(0, MODHEX_KEY_CODE[bytes[i] & 0xf]);
     }
+    kbd_release();
 }
 
 void usb_kbd_send_enter() {
-    uint8_t report[8] = {0, 0, 40};
-    io_usb_send_data(1, report, 8);
-    io_usb_send_data(1, EMPTY_REPORT, 8);
+    kbd_press(0, 40);
+    kbd_release();
 }
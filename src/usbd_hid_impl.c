@@ -59,6 +59,8 @@
 #include "usbd_def.h"
 #include "os_io_seproxyhal.h"
 
+#include "usb_keyboard.h"
+
 /** @addtogroup STM32_USB_DEVICE_LIBRARY
   * @{
   */
@@ -478,9 +480,21 @@ static uint8_t *USBD_GetDeviceQualifierDesc_impl(uint16_t *length) {
   * @param  length : pointer data length
   * @retval pointer to descriptor buffer
   */
+// offset of bInterval of the keyboard IN endpoint in USBD_CfgDesc:
+// configuration, interface and HID descriptors, then the 7th byte of the
+// endpoint descriptor
+#define KBD_EPIN_BINTERVAL_OFFSET (9 + 9 + 9 + 6)
+
+// copy of USBD_CfgDesc with the keyboard polling interval of the current
+// typing profile
+static uint8_t USBD_CfgDesc_kbd_interval[sizeof(USBD_CfgDesc)];
+
 static uint8_t *USBD_GetCfgDesc_impl(uint16_t *length) {
-    *length = sizeof(USBD_CfgDesc);
-    return (uint8_t *)USBD_CfgDesc;
+    os_memmove(USBD_CfgDesc_kbd_interval, USBD_CfgDesc, sizeof(USBD_CfgDesc));
+    USBD_CfgDesc_kbd_interval[KBD_EPIN_BINTERVAL_OFFSET] =
+        usb_kbd_polling_interval();
+    *length = sizeof(USBD_CfgDesc_kbd_interval);
+    return USBD_CfgDesc_kbd_interval;
 }
 
 uint8_t *USBD_HID_GetHidDescriptor_impl(uint16_t *len) {
@@ -559,6 +573,47 @@ uint8_t USBD_HID_DataOut_impl(USBD_HandleTypeDef *pdev, uint8_t epnum,
     return USBD_OK;
 }
 
+/**
+  * @brief  USBD_HID_Init
+  *         (re)initialize the HID class when the host sets a configuration
+  * @param  pdev: device instance
+  * @param  cfgidx: configuration index
+  * @retval status
+  *
+  * Keyboard reports that were queued or in flight are lost at this point, so
+  * the keyboard transmit queue is reset too.
+  */
+uint8_t USBD_HID_Init_impl(USBD_HandleTypeDef *pdev, uint8_t cfgidx) {
+    usb_kbd_init();
+    return USBD_HID_Init(pdev, cfgidx);
+}
+
+/**
+  * @brief  USBD_HID_DataIn
+  *         handle data IN Stage
+  * @param  pdev: device instance
+  * @param  epnum: endpoint index
+  * @retval status
+  *
+  * Called once the host has received a report sent over an IN endpoint.
+  */
+uint8_t USBD_HID_DataIn_impl(USBD_HandleTypeDef *pdev, uint8_t epnum) {
+    UNUSED(pdev);
+    switch (epnum) {
+    // keyboard endpoint
+    case 1:
+        usb_kbd_report_sent();
+        break;
+
+    // generic endpoint: send the next chunk of an APDU response, if any
+    case (HID_EPIN_ADDR & 0x7F):
+        io_usb_hid_sent(io_usb_send_apdu_data);
+        break;
+    }
+
+    return USBD_OK;
+}
+
 /** @defgroup USBD_HID_Private_Functions
   * @{
   */
@@ -572,9 +627,9 @@ const USBD_DescriptorsTypeDef const HID_Desc = {
 };
 
 static const USBD_ClassTypeDef const USBD_HID = {
-    USBD_HID_Init, USBD_HID_DeInit, USBD_HID_Setup, NULL, /*EP0_TxSent*/
+    USBD_HID_Init_impl, USBD_HID_DeInit, USBD_HID_Setup, NULL, /*EP0_TxSent*/
     NULL, /*EP0_RxReady*/                                 /* STATUS STAGE IN */
-    NULL,                                                 /*DataIn*/
+    USBD_HID_DataIn_impl,                                 /*DataIn*/
     USBD_HID_DataOut_impl,                                /*DataOut*/
     NULL,                                                 /*SOF */
     NULL, NULL, USBD_GetCfgDesc_impl, USBD_GetCfgDesc_impl,